@@ -0,0 +1,274 @@
+/* Autotune.h | Workgroup size autotuner: candidate configurations are timed on the device, and the best one is kept per device */
+
+#pragma once
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <algorithm>
+#include <CL/cl.hpp>
+#include "Statistics.h"
+#include "ProgramCache.h"
+#include "BitonicSort.h"
+#include "Benchmark.h"
+#include "Summary.h"
+
+using namespace std;
+
+// Tuning profiles of every device tuned so far, one line per device: name, then the fields of TuningProfile
+const string TUNING_PROFILE_FILE = "autotune.profile";
+
+// Elements per work-item tried for the strided kernels (the number of workgroups follows from it)
+const size_t TUNING_ITEMS[] = { 1, 4, 16, 64, 256 };
+
+// Workgroup configuration of the single device pipeline. The local sizes are baked into the program as build
+// options (see TuningBuildOptions), so every launch of those kernels must use them.
+struct TuningProfile {
+	size_t stats_local = 256;
+	size_t stats_items = 16;
+	size_t histogram_local = 256;
+	size_t histogram_items = 16;
+	size_t sort_local = 16;
+};
+
+// Time of one candidate configuration of a kernel (median of the repetitions)
+struct TuningSample {
+	string kernel;
+	size_t local_size;
+	size_t items;
+	double median_ns;
+};
+
+// Name a device is tuned under (without the padding some drivers leave at the end of the name)
+string TuningDeviceName(const cl::Device& device) {
+	string name = device.getInfo<CL_DEVICE_NAME>();
+	while (!name.empty() && (name.back() == '\0' || name.back() == ' '))
+		name.pop_back();
+	return name;
+}
+
+// Build options which bake the local sizes of a profile into the program (see STATS_LOCAL in my_kernels.cl)
+string TuningBuildOptions(const TuningProfile& profile) {
+	return "-D STATS_LOCAL=" + to_string(profile.stats_local) + " -D HISTOGRAM_LOCAL=" + to_string(profile.histogram_local)
+		+ " -D SORT_LOCAL=" + to_string(profile.sort_local);
+}
+
+// Read the profile of a device. Returns false (leaving profile untouched) if the device has not been tuned.
+bool LoadTuningProfile(const string& file_name, const cl::Device& device, TuningProfile& profile) {
+	ifstream file(file_name);
+	string name = TuningDeviceName(device), line;
+
+	while (getline(file, line))
+	{
+		size_t tab = line.find('\t');
+		if (tab == string::npos || line.substr(0, tab) != name)
+			continue;
+
+		TuningProfile loaded;
+		stringstream fields(line.substr(tab + 1));
+		if (!(fields >> loaded.stats_local >> loaded.stats_items >> loaded.histogram_local >> loaded.histogram_items >> loaded.sort_local))
+			return false;
+		if (!loaded.stats_local || !loaded.stats_items || !loaded.histogram_local || !loaded.histogram_items || !loaded.sort_local)
+			return false;
+
+		profile = loaded;
+		return true;
+	}
+	return false;
+}
+
+// Write the profile of a device, keeping the profiles of the other devices. Returns false if the file cannot be written.
+bool SaveTuningProfile(const string& file_name, const cl::Device& device, const TuningProfile& profile) {
+	string name = TuningDeviceName(device), line;
+	vector<string> lines;
+
+	ifstream existing(file_name);
+	while (getline(existing, line))
+	{
+		if (!line.empty() && line.substr(0, line.find('\t')) != name)
+			lines.push_back(line);
+	}
+	existing.close();
+
+	stringstream entry;
+	entry << name << "\t" << profile.stats_local << " " << profile.stats_items << " " << profile.histogram_local << " "
+		<< profile.histogram_items << " " << profile.sort_local;
+	lines.push_back(entry.str());
+
+	// Write to a temporary file first, so that an interrupted run keeps the previous profiles
+	string temp_name = file_name + ".tmp";
+	ofstream file(temp_name, ios::trunc);
+	if (!file)
+		return false;
+
+	for (const string& profile_line : lines)
+		file << profile_line << endl;
+	file.close();
+	if (!file)
+	{
+		remove(temp_name.c_str());
+		return false;
+	}
+
+	remove(file_name.c_str());
+	return rename(temp_name.c_str(), file_name.c_str()) == 0;
+}
+
+// Candidate local sizes of a kernel: powers of two from its preferred multiple (and at least 16, the untuned
+// size) up to the largest workgroup it allows, capped at 256 like the untuned launches
+vector<size_t> TuningLocalSizes(const cl::Kernel& kernel, const cl::Device& device) {
+	size_t limit = min((size_t)256, kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device));
+	size_t multiple = max((size_t)1, kernel.getWorkGroupInfo<CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE>(device));
+
+	size_t local_size = 1;
+	while (local_size < min(max(multiple, (size_t)16), limit))
+		local_size *= 2;
+
+	vector<size_t> sizes;
+	for (; local_size <= limit; local_size *= 2)
+		sizes.push_back(local_size);
+	if (sizes.empty())
+		sizes.push_back(local_size / 2);
+	return sizes;
+}
+
+// Time every candidate configuration of the fused statistics, histogram and bitonic sort kernels over a column,
+// and return the fastest configuration of each. Every candidate local size is built into its own program
+// (cached like any other build), exactly as the pipeline will run it. Each timing is the median of the
+// repetitions (after the warm-up runs) of the kernel time from the profiling events.
+TuningProfile AutotuneDevice(const cl::Context& context, const cl::Program& program, const float* A, size_t rows, int warmup, int repetitions, vector<TuningSample>& samples) {
+	cl::Device device = context.getInfo<CL_CONTEXT_DEVICES>()[0];
+	cl::CommandQueue queue(context, CL_QUEUE_PROFILING_ENABLE);
+
+	vector<size_t> stats_sizes = TuningLocalSizes(cl::Kernel(program, "reduce_statistics"), device);
+	vector<size_t> histogram_sizes = TuningLocalSizes(cl::Kernel(program, "histogram"), device);
+	vector<size_t> sort_sizes = TuningLocalSizes(cl::Kernel(program, "bitonic_sort_local"), device);
+
+	vector<size_t> candidates = stats_sizes;
+	candidates.insert(candidates.end(), histogram_sizes.begin(), histogram_sizes.end());
+	candidates.insert(candidates.end(), sort_sizes.begin(), sort_sizes.end());
+	sort(candidates.begin(), candidates.end());
+	candidates.erase(unique(candidates.begin(), candidates.end()), candidates.end());
+
+	cl::Buffer buffer_A(context, CL_MEM_READ_ONLY, rows * sizeof(float));
+	Stats stats;
+	vector<cl_uint> histogram(HISTOGRAM_BINS);
+	queue.enqueueWriteBuffer(buffer_A, CL_TRUE, 0, rows * sizeof(float), A);
+
+	TuningProfile best;
+	double best_stats = -1.0, best_histogram = -1.0, best_sort = -1.0;
+
+	for (size_t local_size : candidates)
+	{
+		TuningProfile candidate;
+		candidate.stats_local = candidate.histogram_local = candidate.sort_local = local_size;
+
+		// A size the compiler rejects for these kernels is simply not a candidate
+		cl::Program tuned_program;
+		try
+		{
+			bool from_cache = false;
+			tuned_program = BuildProgram(context, "my_kernels.cl", TuningBuildOptions(candidate), from_cache);
+		}
+		catch (const cl::Error&)
+		{
+			continue;
+		}
+
+		SummaryKernels kernels = CreateSummaryKernels(tuned_program, device);
+		kernels.stats_local = kernels.histogram_local = local_size;
+
+		for (size_t items : TUNING_ITEMS)
+		{
+			kernels.stats_items = kernels.histogram_items = items;
+			SummaryBuffers buffers = CreateSummaryBuffers(context, kernels, rows);
+
+			// Fused statistics (the combine step is part of the trade-off: fewer items means more partials)
+			if (find(stats_sizes.begin(), stats_sizes.end(), local_size) != stats_sizes.end())
+			{
+				vector<double> times;
+				for (int run = 0; run < warmup + repetitions; run++)
+				{
+					vector<cl::Event> events;
+					cl::Event read_event;
+					EnqueueStatistics(queue, kernels, buffer_A, rows, buffers, vector<cl::Event>(), stats, events, read_event);
+					read_event.wait();
+					if (run >= warmup)
+						times.push_back(EventTime(events));
+				}
+
+				double median = SamplePercentile(times, 50.0);
+				samples.push_back({ "reduce_statistics", local_size, items, median });
+				if (best_stats < 0.0 || median < best_stats)
+				{
+					best_stats = median;
+					best.stats_local = local_size;
+					best.stats_items = items;
+				}
+			}
+
+			// Histogram
+			if (find(histogram_sizes.begin(), histogram_sizes.end(), local_size) != histogram_sizes.end())
+			{
+				vector<double> times;
+				for (int run = 0; run < warmup + repetitions; run++)
+				{
+					cl::Event clear_event, exe_event, read_event;
+					EnqueueHistogram(queue, kernels, buffer_A, rows, buffers, vector<cl::Event>(), &histogram[0], clear_event, exe_event, read_event);
+					read_event.wait();
+					if (run >= warmup)
+						times.push_back(EventTime(exe_event));
+				}
+
+				double median = SamplePercentile(times, 50.0);
+				samples.push_back({ "histogram", local_size, items, median });
+				if (best_histogram < 0.0 || median < best_histogram)
+				{
+					best_histogram = median;
+					best.histogram_local = local_size;
+					best.histogram_items = items;
+				}
+			}
+		}
+
+		// Bitonic sort (one element pair per work-item, so only the local size is swept)
+		if (find(sort_sizes.begin(), sort_sizes.end(), local_size) != sort_sizes.end())
+		{
+			size_t sort_elements = 2 * local_size;
+			while (sort_elements < rows)
+				sort_elements *= 2;
+			cl::Buffer buffer_S(context, CL_MEM_READ_WRITE, sort_elements * sizeof(float));
+
+			vector<double> times;
+			for (int run = 0; run < warmup + repetitions; run++)
+			{
+				// Every run sorts the unsorted column again
+				vector<cl::Event> wait(1), events;
+				queue.enqueueCopyBuffer(buffer_A, buffer_S, 0, 0, rows * sizeof(float), NULL, &wait[0]);
+				if (sort_elements > rows)
+				{
+					wait.push_back(cl::Event());
+					queue.enqueueFillBuffer(buffer_S, SORT_PAD, rows * sizeof(float), (sort_elements - rows) * sizeof(float), NULL, &wait.back());
+				}
+
+				EnqueueBitonicSort(queue, tuned_program, buffer_S, sizeof(float), sort_elements, local_size, wait, events);
+				cl::Event::waitForEvents(events);
+				if (run >= warmup)
+					times.push_back(EventTime(events));
+			}
+
+			double median = SamplePercentile(times, 50.0);
+			samples.push_back({ "bitonic_sort", local_size, 0, median });
+			if (best_sort < 0.0 || median < best_sort)
+			{
+				best_sort = median;
+				best.sort_local = local_size;
+			}
+		}
+	}
+
+	return best;
+}
@@ -0,0 +1,297 @@
+/* Benchmark.h | Benchmark mode: synthetic data sets across a size sweep, every stage timed over repeated runs */
+
+#pragma once
+
+#include <vector>
+#include <string>
+#include <map>
+#include <random>
+#include <chrono>
+#include <cstdio>
+#include <cmath>
+#include <sstream>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <CL/cl.hpp>
+#include "DataLoader.h"
+#include "Statistics.h"
+#include "BitonicSort.h"
+#include "Summary.h"
+
+using namespace std;
+
+// Settings of a benchmark run
+struct BenchmarkConfig {
+	vector<size_t> sizes = { 10000, 100000, 1000000, 10000000, 100000000 };
+	int warmup = 2;
+	int repetitions = 10;
+	string format = "csv";	// csv or json
+	string output_file;		// defaults to benchmark.<format>
+
+	// Launch configuration of the main pipeline: the tuning profile of the device when it has one (with the program
+	// built from the same profile), otherwise the untuned defaults of the pipeline
+	bool tuned = false;
+	size_t stats_local = 0;
+	size_t stats_items = 0;
+	size_t histogram_local = 0;
+	size_t histogram_items = 0;
+	size_t sort_local = 16;
+};
+
+// Parse a comma separated list of data set sizes (e.g. "10000,1000000")
+vector<size_t> ParseBenchmarkSizes(const string& list) {
+	vector<size_t> sizes;
+	stringstream items(list);
+	string item;
+
+	while (getline(items, item, ','))
+	{
+		// Every stage needs at least one element per quartile
+		size_t size = strtoull(item.c_str(), NULL, 10);
+		if (size >= 4)
+			sizes.push_back(size);
+	}
+	return sizes;
+}
+
+// Write a synthetic weather data file of the given number of rows, in the same format as temp_lincolnshire.txt
+// (station, year, month, day, time, temperature). Temperatures follow a seasonal cycle plus noise, at 0.1 degrees.
+bool GenerateWeatherFile(const string& file_name, size_t rows, unsigned int seed = 12421031) {
+	FILE* file = fopen(file_name.c_str(), "wb");
+	if (!file)
+		return false;
+
+	const char* stations[] = { "BARKSTON_HEATH", "CONINGSBY", "CRANWELL", "SCAMPTON", "WADDINGTON" };
+	mt19937 generator(seed);
+	uniform_int_distribution<int> station(0, 4), year(1938, 2018), month(1, 12), day(1, 28), hour(0, 23), half(0, 1);
+	normal_distribution<float> noise(0.f, 4.f);
+
+	// Lines are formatted into a large buffer, written out whenever it fills up
+	vector<char> buffer(1 << 20);
+	size_t used = 0;
+
+	for (size_t row = 0; row < rows; row++)
+	{
+		int m = month(generator);
+		float seasonal = 10.f - 7.f * cos(2.f * 3.14159265f * (m - 1) / 12.f);
+		float temperature = round((seasonal + noise(generator)) * 10.f) / 10.f;
+
+		if (buffer.size() - used < 64)
+		{
+			fwrite(buffer.data(), 1, used, file);
+			used = 0;
+		}
+
+		used += snprintf(buffer.data() + used, buffer.size() - used, "%s %d %02d %02d %02d%02d %.1f\n",
+			stations[station(generator)], year(generator), m, day(generator), hour(generator), half(generator) * 50, temperature);
+	}
+
+	fwrite(buffer.data(), 1, used, file);
+	return fclose(file) == 0;
+}
+
+// Timings of every repetition of every stage, in nanoseconds
+typedef map<string, vector<double>> StageSamples;
+
+inline double EventTime(const cl::Event& event) {
+	return (double)(event.getProfilingInfo<CL_PROFILING_COMMAND_END>() - event.getProfilingInfo<CL_PROFILING_COMMAND_START>());
+}
+
+inline double EventTime(const vector<cl::Event>& events) {
+	double total = 0.0;
+	for (auto& event : events)
+		total += EventTime(event);
+	return total;
+}
+
+// Run every device stage once over A (upload, fused statistics, histogram, bitonic sort, radix select, readbacks)
+// and add the time of each stage to samples (unless this is a warm-up run)
+void BenchmarkDeviceStages(const cl::Context& context, const cl::Program& program, const BenchmarkConfig& config, const float* A, size_t rows, StageSamples* samples) {
+	cl::Device device = context.getInfo<CL_CONTEXT_DEVICES>()[0];
+	cl::CommandQueue queue(context, CL_QUEUE_PROFILING_ENABLE);
+	size_t max_groups = (size_t)device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>() * 4;
+
+	cl::Buffer buffer_A(context, CL_MEM_READ_ONLY, rows * sizeof(float));
+	cl::Event upload_event;
+	queue.enqueueWriteBuffer(buffer_A, CL_TRUE, 0, rows * sizeof(float), A, NULL, &upload_event);
+
+	// Fused statistics and histogram, each read back before the next stage
+	SummaryKernels kernels = CreateSummaryKernels(program, device);
+	if (config.tuned)
+	{
+		kernels.stats_local = config.stats_local;
+		kernels.stats_items = config.stats_items;
+		kernels.histogram_local = config.histogram_local;
+		kernels.histogram_items = config.histogram_items;
+	}
+	SummaryBuffers buffers = CreateSummaryBuffers(context, kernels, rows);
+
+	vector<cl::Event> stats_events;
+	cl::Event stats_read_event;
+	Stats stats;
+	EnqueueStatistics(queue, kernels, buffer_A, rows, buffers, vector<cl::Event>(), stats, stats_events, stats_read_event);
+	stats_read_event.wait();
+
+	cl::Event histogram_clear_event, histogram_event, histogram_read_event;
+	vector<cl_uint> histogram(HISTOGRAM_BINS);
+	EnqueueHistogram(queue, kernels, buffer_A, rows, buffers, vector<cl::Event>(), &histogram[0], histogram_clear_event, histogram_event, histogram_read_event);
+	histogram_read_event.wait();
+
+	// Bitonic sort
+	size_t sort_local = config.sort_local;
+	size_t sort_elements = 2 * sort_local;
+	while (sort_elements < rows)
+		sort_elements *= 2;
+
+	cl::Buffer buffer_S(context, CL_MEM_READ_WRITE, sort_elements * sizeof(float));
+	vector<cl::Event> sort_wait, sort_events;
+	queue.enqueueCopyBuffer(buffer_A, buffer_S, 0, 0, rows * sizeof(float));
+	if (sort_elements > rows)
+		queue.enqueueFillBuffer(buffer_S, SORT_PAD, rows * sizeof(float), (sort_elements - rows) * sizeof(float));
+	EnqueueBitonicSort(queue, program, buffer_S, sizeof(float), sort_elements, sort_local, sort_wait, sort_events);
+
+	cl::Event sorted_read_event;
+	vector<float> sorted(rows);
+	queue.enqueueReadBuffer(buffer_S, CL_TRUE, 0, rows * sizeof(float), &sorted[0], NULL, &sorted_read_event);
+
+	// Radix select of the quartile ranks
+	cl::Kernel select_kernel = cl::Kernel(program, "radix_select_histogram");
+	cl::Kernel narrow_kernel = cl::Kernel(program, "radix_select_narrow");
+	size_t select_local = min((size_t)256, select_kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device));
+	size_t select_groups = max((size_t)1, min((rows + select_local - 1) / select_local, max_groups));
+
+	vector<size_t> ranks = OrderStatisticRanks(rows);
+	vector<cl_uint> remaining(ranks.begin(), ranks.end());
+	vector<cl_uint> prefix(ranks.size(), 0);
+	size_t select_histogram_size = ranks.size() * 256 * sizeof(cl_uint);
+
+	cl::Buffer buffer_prefix(context, CL_MEM_READ_WRITE, ranks.size() * sizeof(cl_uint));
+	cl::Buffer buffer_remaining(context, CL_MEM_READ_WRITE, ranks.size() * sizeof(cl_uint));
+	cl::Buffer buffer_H(context, CL_MEM_READ_WRITE, select_histogram_size);
+	queue.enqueueWriteBuffer(buffer_prefix, CL_FALSE, 0, ranks.size() * sizeof(cl_uint), &prefix[0]);
+	queue.enqueueWriteBuffer(buffer_remaining, CL_FALSE, 0, ranks.size() * sizeof(cl_uint), &remaining[0]);
+
+	select_kernel.setArg(0, buffer_A);
+	select_kernel.setArg(1, buffer_H);
+	select_kernel.setArg(2, buffer_prefix);
+	select_kernel.setArg(3, cl::Local(select_histogram_size));
+	select_kernel.setArg(4, (cl_int)rows);
+	select_kernel.setArg(5, (cl_int)ranks.size());
+	narrow_kernel.setArg(0, buffer_H);
+	narrow_kernel.setArg(1, buffer_prefix);
+	narrow_kernel.setArg(2, buffer_remaining);
+
+	vector<cl::Event> select_events;
+	for (int shift = 24; shift >= 0; shift -= 8)
+	{
+		select_kernel.setArg(6, (cl_uint)((shift == 24) ? 0 : (0xFFFFFFFFu << (shift + 8))));
+		select_kernel.setArg(7, (cl_int)shift);
+		narrow_kernel.setArg(3, (cl_int)shift);
+
+		queue.enqueueFillBuffer(buffer_H, (cl_uint)0, 0, select_histogram_size);
+		select_events.push_back(cl::Event());
+		queue.enqueueNDRangeKernel(select_kernel, cl::NullRange, cl::NDRange(select_groups * select_local), cl::NDRange(select_local), NULL, &select_events.back());
+		select_events.push_back(cl::Event());
+		queue.enqueueNDRangeKernel(narrow_kernel, cl::NullRange, cl::NDRange(ranks.size()), cl::NullRange, NULL, &select_events.back());
+	}
+
+	cl::Event prefix_read_event;
+	queue.enqueueReadBuffer(buffer_prefix, CL_TRUE, 0, ranks.size() * sizeof(cl_uint), &prefix[0], NULL, &prefix_read_event);
+
+	if (!samples)
+		return;
+
+	(*samples)["upload"].push_back(EventTime(upload_event));
+	(*samples)["reduce_statistics"].push_back(EventTime(stats_events[0]));
+	(*samples)["combine_statistics"].push_back(EventTime(stats_events[1]));
+	(*samples)["histogram"].push_back(EventTime(histogram_event));
+	(*samples)["bitonic_sort"].push_back(EventTime(sort_events));
+	(*samples)["radix_select"].push_back(EventTime(select_events));
+	(*samples)["readback_statistics"].push_back(EventTime(stats_read_event));
+	(*samples)["readback_histogram"].push_back(EventTime(histogram_read_event));
+	(*samples)["readback_sorted"].push_back(EventTime(sorted_read_event));
+	(*samples)["readback_selected"].push_back(EventTime(prefix_read_event));
+}
+
+// Value at a percentile (0 to 100) of a set of samples (nearest rank)
+double SamplePercentile(vector<double> samples, double percentile) {
+	if (samples.empty())
+		return 0.0;
+	sort(samples.begin(), samples.end());
+	size_t rank = (size_t)ceil(percentile / 100.0 * samples.size());
+	return samples[min(max(rank, (size_t)1), samples.size()) - 1];
+}
+
+// Run the whole sweep and write min/median/p95 of every stage at every size. Returns false if a file cannot be written.
+bool RunBenchmark(const cl::Context& context, const cl::Program& program, const BenchmarkConfig& config) {
+	string output_file = config.output_file.empty() ? "benchmark." + config.format : config.output_file;
+	ofstream output(output_file);
+	if (!output)
+		return false;
+
+	bool json = (config.format == "json");
+	if (json)
+		output << "[" << endl;
+	else
+		output << "rows,stage,repetitions,min_ns,median_ns,p95_ns" << endl;
+
+	bool first_record = true;
+	for (size_t rows : config.sizes)
+	{
+		// The generated files are kept, so that later runs (and other devices) use exactly the same data
+		string data_file = "benchmark_" + to_string(rows) + ".txt";
+		ifstream existing(data_file);
+		if (!existing)
+		{
+			cout << "Generating " << data_file << "..." << endl;
+			if (!GenerateWeatherFile(data_file, rows))
+				return false;
+		}
+		existing.close();
+
+		cout << "Benchmarking " << rows << " rows..." << endl;
+		StageSamples samples;
+
+		for (int run = 0; run < config.warmup + config.repetitions; run++)
+		{
+			bool warmup = run < config.warmup;
+
+			WeatherData data;
+			auto load_start = chrono::high_resolution_clock::now();
+			if (!LoadWeatherData(data_file, data))
+				return false;
+			auto load_end = chrono::high_resolution_clock::now();
+
+			if (!warmup)
+				samples["load"].push_back((double)chrono::duration_cast<chrono::nanoseconds>(load_end - load_start).count());
+
+			BenchmarkDeviceStages(context, program, config, data.temperature, data.rows, warmup ? NULL : &samples);
+		}
+
+		for (auto& stage : samples)
+		{
+			double low = *min_element(stage.second.begin(), stage.second.end());
+			double median = SamplePercentile(stage.second, 50.0);
+			double p95 = SamplePercentile(stage.second, 95.0);
+
+			if (json)
+			{
+				output << (first_record ? "" : ",\n") << "  { \"rows\": " << rows << ", \"stage\": \"" << stage.first << "\", \"repetitions\": " << stage.second.size()
+					<< ", \"min_ns\": " << (unsigned long long)low << ", \"median_ns\": " << (unsigned long long)median << ", \"p95_ns\": " << (unsigned long long)p95 << " }";
+			}
+			else
+			{
+				output << rows << "," << stage.first << "," << stage.second.size() << "," << (unsigned long long)low << ","
+					<< (unsigned long long)median << "," << (unsigned long long)p95 << endl;
+			}
+			first_record = false;
+		}
+	}
+
+	if (json)
+		output << endl << "]" << endl;
+
+	cout << "Benchmark results written to " << output_file << endl;
+	return (bool)output;
+}
@@ -0,0 +1,56 @@
+/* BitonicSort.h | Host side of the bitonic sort kernels in my_kernels.cl */
+
+#pragma once
+
+#include <vector>
+#include <climits>
+#include <CL/cl.hpp>
+
+using namespace std;
+
+// Neutral values padding a sort buffer up to a power of two: never a reading, and sorted after every reading
+const float SORT_PAD = 300000.f;			// 32-bit float temperatures
+const cl_short FIXED_PAD = SHRT_MAX;		// int16 tenths of a degree (see FixedPoint.h)
+
+// Enqueue an in-place bitonic sort of a buffer holding sort_elements elements of element_size bytes
+// (sort_elements must be a power of two and at least 2 * local_size). Each launch waits for the previous one,
+// the first for the events in wait; wait is left holding the last launch and every launch is appended to events.
+void EnqueueBitonicSort(const cl::CommandQueue& queue, const cl::Program& program, const cl::Buffer& buffer, size_t element_size,
+	size_t sort_elements, size_t local_size, vector<cl::Event>& wait, vector<cl::Event>& events) {
+	cl::Kernel sort_local = cl::Kernel(program, "bitonic_sort_local");
+	sort_local.setArg(0, buffer);
+	sort_local.setArg(1, cl::Local(2 * local_size * element_size));
+
+	cl::Kernel merge_global = cl::Kernel(program, "bitonic_merge_global");
+	merge_global.setArg(0, buffer);
+
+	cl::Kernel merge_local = cl::Kernel(program, "bitonic_merge_local");
+	merge_local.setArg(0, buffer);
+	merge_local.setArg(1, cl::Local(2 * local_size * element_size));
+
+	// One work-item per pair of elements
+	cl::NDRange pairs(sort_elements / 2);
+
+	// Sort every block of 2 * local_size elements in local memory
+	events.push_back(cl::Event());
+	queue.enqueueNDRangeKernel(sort_local, cl::NullRange, pairs, cl::NDRange(local_size), &wait, &events.back());
+	wait = { events.back() };
+
+	// Merge the blocks: steps wider than a block go through global memory, the rest run in local memory
+	for (size_t k = 4 * local_size; k <= sort_elements; k *= 2)
+	{
+		for (size_t j = k / 2; j > local_size; j /= 2)
+		{
+			merge_global.setArg(1, (cl_int)k);
+			merge_global.setArg(2, (cl_int)j);
+			events.push_back(cl::Event());
+			queue.enqueueNDRangeKernel(merge_global, cl::NullRange, pairs, cl::NDRange(local_size), &wait, &events.back());
+			wait = { events.back() };
+		}
+
+		merge_local.setArg(2, (cl_int)k);
+		events.push_back(cl::Event());
+		queue.enqueueNDRangeKernel(merge_local, cl::NullRange, pairs, cl::NDRange(local_size), &wait, &events.back());
+		wait = { events.back() };
+	}
+}
@@ -0,0 +1,126 @@
+/* Compaction.h | Predicate pushdown: the temperatures of the rows matching a filter are compacted into a dense buffer on the device */
+
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <CL/cl.hpp>
+#include "Filter.h"
+
+using namespace std;
+
+// Buffers and commands of one compaction (kept alive until its commands are done)
+struct Compaction {
+	cl::Buffer flags;				// match flags, scanned in place into the output slot of every row
+	vector<cl::Buffer> sums;		// block totals of every level of the scan (the last one holds the total)
+	cl::Buffer output;				// temperatures of the matching rows, densely packed
+	cl_uint count = 0;
+	vector<cl::Event> kernel_events;
+	vector<cl::Event> transfer_events;
+};
+
+// Largest power of two workgroup the scan kernels allow (each workgroup scans a block of 2 * local_size elements)
+size_t ScanLocalSize(const cl::Program& program, const cl::Device& device) {
+	size_t limit = min((size_t)256, cl::Kernel(program, "scan_blocks").getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device));
+	size_t local_size = 1;
+	while (local_size * 2 <= limit)
+		local_size *= 2;
+	return local_size;
+}
+
+// Enqueue an in-place exclusive scan of a buffer of elements of element_size bytes (SCAN_T of the program; elements must
+// be a multiple of 2 * local_size, with the padding set to zero). Every block is scanned, then the block totals are scanned the same way and added back, so
+// one more level is needed per factor of 2 * local_size. The total of every element ends up in sums.back()[0].
+// Each launch waits for the previous one, the first for the events in wait; wait is left holding the last launch.
+void EnqueueExclusiveScan(const cl::Context& context, const cl::CommandQueue& queue, const cl::Program& program, const cl::Buffer& buffer, size_t element_size, size_t elements,
+	size_t local_size, vector<cl::Buffer>& sums, vector<cl::Event>& wait, vector<cl::Event>& events) {
+	size_t block_elements = 2 * local_size;
+	size_t blocks = elements / block_elements;
+
+	// The totals are padded to a whole number of blocks (with zeros) for the next level
+	size_t sum_elements = (blocks + block_elements - 1) / block_elements * block_elements;
+	sums.push_back(cl::Buffer(context, CL_MEM_READ_WRITE, sum_elements * element_size));
+	cl::Buffer block_sums = sums.back();
+
+	if (sum_elements > blocks)
+	{
+		cl::Event fill_event;
+		queue.enqueueFillBuffer(block_sums, (cl_uint)0, blocks * element_size, (sum_elements - blocks) * element_size, NULL, &fill_event);
+		wait.push_back(fill_event);
+	}
+
+	cl::Kernel scan_blocks = cl::Kernel(program, "scan_blocks");
+	scan_blocks.setArg(0, buffer);
+	scan_blocks.setArg(1, block_sums);
+	scan_blocks.setArg(2, cl::Local(block_elements * element_size));
+
+	events.push_back(cl::Event());
+	queue.enqueueNDRangeKernel(scan_blocks, cl::NullRange, cl::NDRange(blocks * local_size), cl::NDRange(local_size), &wait, &events.back());
+	wait = { events.back() };
+
+	if (blocks == 1)
+		return;
+
+	EnqueueExclusiveScan(context, queue, program, block_sums, element_size, sum_elements, local_size, sums, wait, events);
+
+	cl::Kernel scan_add = cl::Kernel(program, "scan_add");
+	scan_add.setArg(0, buffer);
+	scan_add.setArg(1, block_sums);
+
+	events.push_back(cl::Event());
+	queue.enqueueNDRangeKernel(scan_add, cl::NullRange, cl::NDRange(blocks * local_size), cl::NDRange(local_size), &wait, &events.back());
+	wait = { events.back() };
+}
+
+// Compact the temperatures of the rows matching a filter into compaction.output, which holds at least capacity
+// floats (capacity >= rows). The station, date/time and temperature columns must already be on the device (the
+// uploads are in wait). Blocks only for the number of matching rows, which is returned (the compaction itself is
+// left running: later stages wait for compaction.kernel_events.back()).
+size_t CompactRows(const cl::Context& context, const cl::CommandQueue& queue, const cl::Program& program, const cl::Buffer& stations, const cl::Buffer& date_times, const cl::Buffer& A,
+	size_t rows, const RowFilter& filter, size_t capacity, vector<cl::Event> wait, Compaction& compaction) {
+	cl::Device device = context.getInfo<CL_CONTEXT_DEVICES>()[0];
+
+	size_t local_size = ScanLocalSize(program, device);
+	size_t block_elements = 2 * local_size;
+	size_t elements = max((size_t)1, (rows + block_elements - 1) / block_elements) * block_elements;
+
+	compaction.flags = cl::Buffer(context, CL_MEM_READ_WRITE, elements * sizeof(cl_uint));
+	compaction.output = cl::Buffer(context, CL_MEM_READ_WRITE, max(capacity, (size_t)1) * sizeof(float));
+	compaction.sums.clear();
+
+	// Flag every row (the padding gets a zero flag)
+	cl::Kernel flags_kernel = cl::Kernel(program, "filter_flags");
+	flags_kernel.setArg(0, stations);
+	flags_kernel.setArg(1, date_times);
+	flags_kernel.setArg(2, compaction.flags);
+	flags_kernel.setArg(3, (cl_int)rows);
+	SetFilterArgs(flags_kernel, 4, filter);
+
+	compaction.kernel_events.push_back(cl::Event());
+	queue.enqueueNDRangeKernel(flags_kernel, cl::NullRange, cl::NDRange(elements), cl::NullRange, &wait, &compaction.kernel_events.back());
+	wait = { compaction.kernel_events.back() };
+
+	// Output slot of every row
+	EnqueueExclusiveScan(context, queue, program, compaction.flags, sizeof(cl_uint), elements, local_size, compaction.sums, wait, compaction.kernel_events);
+	vector<cl::Event> scanned = wait;
+
+	cl::Kernel compact_kernel = cl::Kernel(program, "compact_rows");
+	compact_kernel.setArg(0, stations);
+	compact_kernel.setArg(1, date_times);
+	compact_kernel.setArg(2, A);
+	compact_kernel.setArg(3, compaction.flags);
+	compact_kernel.setArg(4, compaction.output);
+	compact_kernel.setArg(5, (cl_int)rows);
+	SetFilterArgs(compact_kernel, 6, filter);
+
+	// The count is read while the rows are compacted
+	compaction.transfer_events.push_back(cl::Event());
+	queue.enqueueReadBuffer(compaction.sums.back(), CL_FALSE, 0, sizeof(cl_uint), &compaction.count, &scanned, &compaction.transfer_events.back());
+
+	compaction.kernel_events.push_back(cl::Event());
+	queue.enqueueNDRangeKernel(compact_kernel, cl::NullRange, cl::NDRange(elements), cl::NullRange, &scanned, &compaction.kernel_events.back());
+
+	queue.flush();
+	compaction.transfer_events.back().wait();
+	return compaction.count;
+}
@@ -0,0 +1,506 @@
+/* DataLoader.h | Memory-mapped, multi-threaded loader for the weather station text files */
+
+#pragma once
+
+#include <vector>
+#include <string>
+#include <thread>
+#include <cstring>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <algorithm>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+// Read-only view of a whole file mapped into the address space of the process
+struct MappedFile {
+	const char* data = nullptr;
+	size_t size = 0;
+#ifdef _WIN32
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = NULL;
+#else
+	int fd = -1;
+#endif
+};
+
+void UnmapFile(MappedFile& mapped);
+
+// Size of the pages the columns are aligned to (what OpenCL runtimes need to use host memory in place, see ZeroCopy.h)
+const size_t COLUMN_PAGE_SIZE = 4096;
+
+// Bytes allocated for a column of this many bytes: whole pages, with at least one spare page at the end
+// (room for the padding of a workgroup when a device buffer is created over the column)
+inline size_t PageAllocationSize(size_t bytes) {
+	return (bytes / COLUMN_PAGE_SIZE + 2) * COLUMN_PAGE_SIZE;
+}
+
+// Allocator of page-aligned memory for the columns (see PageAllocationSize)
+template<typename T>
+struct PageAllocator {
+	typedef T value_type;
+
+	PageAllocator() {}
+	template<typename U> PageAllocator(const PageAllocator<U>&) {}
+
+	T* allocate(size_t n) {
+		size_t bytes = PageAllocationSize(n * sizeof(T));
+#ifdef _WIN32
+		void* p = _aligned_malloc(bytes, COLUMN_PAGE_SIZE);
+#else
+		void* p = nullptr;
+		if (posix_memalign(&p, COLUMN_PAGE_SIZE, bytes) != 0)
+			p = nullptr;
+#endif
+		if (!p)
+			throw bad_alloc();
+		return (T*)p;
+	}
+
+	void deallocate(T* p, size_t) {
+#ifdef _WIN32
+		_aligned_free(p);
+#else
+		free(p);
+#endif
+	}
+};
+
+template<typename T, typename U> bool operator==(const PageAllocator<T>&, const PageAllocator<U>&) { return true; }
+template<typename T, typename U> bool operator!=(const PageAllocator<T>&, const PageAllocator<U>&) { return false; }
+
+template<typename T> using PageVector = vector<T, PageAllocator<T>>;
+
+// Pack a date and time of day into one 32-bit value that sorts chronologically
+// (year: 11 bits, month: 4 bits, day: 5 bits, time as hhmm: 12 bits)
+inline uint32_t PackDateTime(int year, int month, int day, int time) {
+	return ((uint32_t)year << 21) | ((uint32_t)month << 17) | ((uint32_t)day << 12) | (uint32_t)time;
+}
+
+inline int UnpackYear(uint32_t date_time) { return (int)(date_time >> 21); }
+inline int UnpackMonth(uint32_t date_time) { return (int)((date_time >> 17) & 0xF); }
+inline int UnpackDay(uint32_t date_time) { return (int)((date_time >> 12) & 0x1F); }
+inline int UnpackTime(uint32_t date_time) { return (int)(date_time & 0xFFF); }
+
+// Column-oriented storage of every row in the weather data file
+// Station names are dictionary-encoded (a small id per row plus a lookup table) and the
+// year/month/day/time columns are packed into one 32-bit value per row (see PackDateTime).
+struct WeatherData {
+	size_t rows = 0;
+
+	// Station dictionary: id -> name
+	vector<string> stations;
+
+	// Columns owned by the loader (left empty when the data comes from a cache file), page-aligned so that
+	// devices which share host memory can use them in place
+	PageVector<uint16_t> stationIdColumn;
+	PageVector<uint32_t> dateTimeColumn;
+	PageVector<float> airTemp;
+
+	// Columns in use, pointing either at the vectors above or straight into a memory-mapped cache file
+	const uint16_t* stationId = nullptr;
+	const uint32_t* dateTime = nullptr;
+	const float* temperature = nullptr;
+
+	// Keeps the cache file mapped for as long as the columns are in use
+	MappedFile cache;
+
+	WeatherData() {}
+	WeatherData(const WeatherData&) = delete;
+	WeatherData& operator=(const WeatherData&) = delete;
+	~WeatherData() { UnmapFile(cache); }
+};
+
+// Look up the id of a station by name. Returns -1 if the station does not appear in the data.
+int FindStation(const WeatherData& data, const string& name) {
+	for (size_t i = 0; i < data.stations.size(); i++)
+	{
+		if (data.stations[i] == name)
+			return (int)i;
+	}
+	return -1;
+}
+
+bool MapFile(MappedFile& mapped, const string& file_name) {
+#ifdef _WIN32
+	mapped.file = CreateFileA(file_name.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (mapped.file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER file_size;
+	GetFileSizeEx(mapped.file, &file_size);
+	mapped.size = (size_t)file_size.QuadPart;
+
+	// Empty files cannot be mapped, but are still valid (zero rows)
+	if (mapped.size == 0)
+		return true;
+
+	mapped.mapping = CreateFileMappingA(mapped.file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mapped.mapping == NULL)
+		return false;
+
+	mapped.data = (const char*)MapViewOfFile(mapped.mapping, FILE_MAP_READ, 0, 0, 0);
+	return mapped.data != nullptr;
+#else
+	mapped.fd = open(file_name.c_str(), O_RDONLY);
+	if (mapped.fd < 0)
+		return false;
+
+	struct stat file_info;
+	if (fstat(mapped.fd, &file_info) != 0)
+		return false;
+	mapped.size = (size_t)file_info.st_size;
+
+	// Empty files cannot be mapped, but are still valid (zero rows)
+	if (mapped.size == 0)
+		return true;
+
+	void* data = mmap(NULL, mapped.size, PROT_READ, MAP_PRIVATE, mapped.fd, 0);
+	if (data == MAP_FAILED)
+		return false;
+
+	// The file is read front to back exactly once
+	madvise(data, mapped.size, MADV_SEQUENTIAL);
+	mapped.data = (const char*)data;
+	return true;
+#endif
+}
+
+void UnmapFile(MappedFile& mapped) {
+#ifdef _WIN32
+	if (mapped.data) UnmapViewOfFile(mapped.data);
+	if (mapped.mapping) CloseHandle(mapped.mapping);
+	if (mapped.file != INVALID_HANDLE_VALUE) CloseHandle(mapped.file);
+	mapped.mapping = NULL;
+	mapped.file = INVALID_HANDLE_VALUE;
+#else
+	if (mapped.data) munmap((void*)mapped.data, mapped.size);
+	if (mapped.fd >= 0) close(mapped.fd);
+	mapped.fd = -1;
+#endif
+	mapped.data = nullptr;
+	mapped.size = 0;
+}
+
+// Skip spaces and tabs between two columns
+inline const char* SkipBlanks(const char* p, const char* end) {
+	while (p < end && (*p == ' ' || *p == '\t'))
+		p++;
+	return p;
+}
+
+// Hand-rolled integer scanner (avoids the locale handling of the stream extraction operators)
+inline const char* ScanInt(const char* p, const char* end, int& value) {
+	p = SkipBlanks(p, end);
+
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+'))
+		negative = (*p++ == '-');
+
+	int result = 0;
+	while (p < end && (unsigned)(*p - '0') < 10)
+		result = result * 10 + (*p++ - '0');
+
+	value = negative ? -result : result;
+	return p;
+}
+
+// Hand-rolled decimal scanner for the temperature column (e.g. "-3.5", "10.0")
+inline const char* ScanFloat(const char* p, const char* end, float& value) {
+	p = SkipBlanks(p, end);
+
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+'))
+		negative = (*p++ == '-');
+
+	long long mantissa = 0;
+	int scale = 1;
+	while (p < end && (unsigned)(*p - '0') < 10)
+		mantissa = mantissa * 10 + (*p++ - '0');
+
+	if (p < end && *p == '.')
+	{
+		p++;
+		while (p < end && (unsigned)(*p - '0') < 10 && scale < 100000000)
+		{
+			mantissa = mantissa * 10 + (*p++ - '0');
+			scale *= 10;
+		}
+		// Ignore any digits beyond the supported precision
+		while (p < end && (unsigned)(*p - '0') < 10)
+			p++;
+	}
+
+	double result = (double)mantissa / scale;
+	value = (float)(negative ? -result : result);
+	return p;
+}
+
+// Scan the station name column (any run of non-blank characters)
+inline const char* ScanToken(const char* p, const char* end, const char*& token, size_t& length) {
+	p = SkipBlanks(p, end);
+	token = p;
+	while (p < end && *p != ' ' && *p != '\t' && *p != '\n' && *p != '\r')
+		p++;
+	length = p - token;
+	return p;
+}
+
+// Returns true if the line between p and end holds a record (i.e. it is not blank)
+inline bool IsRecord(const char* p, const char* end) {
+	p = SkipBlanks(p, end);
+	return p < end && *p != '\n' && *p != '\r';
+}
+
+// Count the records held in a chunk of the file
+size_t CountRecords(const char* begin, const char* end) {
+	size_t count = 0;
+	const char* p = begin;
+
+	while (p < end)
+	{
+		const char* eol = (const char*)memchr(p, '\n', end - p);
+		if (!eol) eol = end;
+		if (IsRecord(p, eol)) count++;
+		p = eol + 1;
+	}
+
+	return count;
+}
+
+// Station dictionary built by one parsing thread. There are only a handful of distinct stations,
+// so a linear search (starting from the station of the previous row) beats hashing every name.
+struct LocalDictionary {
+	vector<string> names;
+	size_t last = 0;
+
+	uint16_t Encode(const char* token, size_t length) {
+		if (last < names.size() && names[last].size() == length && memcmp(names[last].data(), token, length) == 0)
+			return (uint16_t)last;
+
+		for (size_t i = 0; i < names.size(); i++)
+		{
+			if (names[i].size() == length && memcmp(names[i].data(), token, length) == 0)
+			{
+				last = i;
+				return (uint16_t)i;
+			}
+		}
+
+		names.emplace_back(token, length);
+		last = names.size() - 1;
+		return (uint16_t)last;
+	}
+};
+
+// Parse the records of a chunk of the file straight into rows [first, ...) of the pre-sized columns
+// Station ids written here are local to the chunk's dictionary and are remapped once every chunk is done.
+void ParseRecords(const char* begin, const char* end, WeatherData& data, size_t first, LocalDictionary& dictionary) {
+	size_t row = first;
+	const char* p = begin;
+	int year, month, day, time;
+
+	while (p < end)
+	{
+		const char* eol = (const char*)memchr(p, '\n', end - p);
+		if (!eol) eol = end;
+
+		if (IsRecord(p, eol))
+		{
+			const char* token;
+			size_t length;
+			const char* q = ScanToken(p, eol, token, length);
+			data.stationIdColumn[row] = dictionary.Encode(token, length);
+			q = ScanInt(q, eol, year);
+			q = ScanInt(q, eol, month);
+			q = ScanInt(q, eol, day);
+			q = ScanInt(q, eol, time);
+			data.dateTimeColumn[row] = PackDateTime(year, month, day, time);
+			ScanFloat(q, eol, data.airTemp[row]);
+			row++;
+		}
+
+		p = eol + 1;
+	}
+}
+
+// Load a weather data file by memory-mapping it, splitting it into newline-aligned chunks and
+// parsing each chunk on its own thread. Returns false if the file cannot be opened.
+bool LoadWeatherData(const string& file_name, WeatherData& data, unsigned int nr_threads = 0) {
+	MappedFile mapped;
+
+	if (!MapFile(mapped, file_name))
+	{
+		UnmapFile(mapped);
+		return false;
+	}
+
+	if (nr_threads == 0)
+		nr_threads = max(1u, thread::hardware_concurrency());
+
+	// Small files are not worth splitting
+	const size_t min_chunk = 1 << 16;
+	nr_threads = (unsigned int)max((size_t)1, min((size_t)nr_threads, mapped.size / min_chunk));
+
+	const char* begin = mapped.data;
+	const char* end = mapped.data + mapped.size;
+
+	// Chunk boundaries, each moved forward to the start of the next line
+	vector<const char*> bounds(nr_threads + 1, end);
+	bounds[0] = begin;
+	for (unsigned int t = 1; t < nr_threads; t++)
+	{
+		const char* p = max(bounds[t - 1], begin + mapped.size / nr_threads * t);
+		const char* eol = (p < end) ? (const char*)memchr(p, '\n', end - p) : nullptr;
+		bounds[t] = eol ? eol + 1 : end;
+	}
+
+	// First pass: count the records in each chunk (in parallel)
+	vector<size_t> counts(nr_threads, 0);
+	vector<thread> workers;
+
+	for (unsigned int t = 0; t < nr_threads; t++)
+		workers.emplace_back([&, t]() { counts[t] = CountRecords(bounds[t], bounds[t + 1]); });
+	for (auto& worker : workers)
+		worker.join();
+	workers.clear();
+
+	// Exclusive scan of the counts gives the first row of each chunk
+	vector<size_t> offsets(nr_threads, 0);
+	size_t rows = 0;
+	for (unsigned int t = 0; t < nr_threads; t++)
+	{
+		offsets[t] = rows;
+		rows += counts[t];
+	}
+
+	// Pre-size every column, so that each thread can write its own rows without synchronisation
+	data.rows = rows;
+	data.stations.clear();
+	data.stationIdColumn.resize(rows);
+	data.dateTimeColumn.resize(rows);
+	data.airTemp.resize(rows);
+
+	// Second pass: parse each chunk straight into its rows (in parallel)
+	vector<LocalDictionary> dictionaries(nr_threads);
+	for (unsigned int t = 0; t < nr_threads; t++)
+		workers.emplace_back([&, t]() { ParseRecords(bounds[t], bounds[t + 1], data, offsets[t], dictionaries[t]); });
+	for (auto& worker : workers)
+		worker.join();
+	workers.clear();
+
+	// Merge the dictionaries of every chunk (in file order, so ids follow the first appearance of each station)
+	vector<vector<uint16_t>> remap(nr_threads);
+	bool identity = true;
+	for (unsigned int t = 0; t < nr_threads; t++)
+	{
+		for (size_t i = 0; i < dictionaries[t].names.size(); i++)
+		{
+			int id = FindStation(data, dictionaries[t].names[i]);
+			if (id < 0)
+			{
+				if (data.stations.size() > UINT16_MAX)
+				{
+					UnmapFile(mapped);
+					return false;
+				}
+				id = (int)data.stations.size();
+				data.stations.push_back(dictionaries[t].names[i]);
+			}
+			remap[t].push_back((uint16_t)id);
+			identity = identity && (id == (int)i);
+		}
+	}
+
+	// Third pass: translate chunk-local station ids into dictionary ids (in parallel), unless no chunk needs it
+	if (!identity)
+	{
+		for (unsigned int t = 0; t < nr_threads; t++)
+			workers.emplace_back([&, t]() {
+				for (size_t row = offsets[t]; row < offsets[t] + counts[t]; row++)
+					data.stationIdColumn[row] = remap[t][data.stationIdColumn[row]];
+			});
+		for (auto& worker : workers)
+			worker.join();
+	}
+
+	data.stationId = data.stationIdColumn.data();
+	data.dateTime = data.dateTimeColumn.data();
+	data.temperature = data.airTemp.data();
+
+	UnmapFile(mapped);
+	return true;
+}
+
+// Sequential reader which parses the temperature column of a weather data file one chunk of rows at a time
+// Used by the streaming mode: only the pages being parsed need to be resident, so the file can be bigger than memory.
+struct TemperatureReader {
+	MappedFile mapped;
+	const char* position = nullptr;
+
+	TemperatureReader() {}
+	TemperatureReader(const TemperatureReader&) = delete;
+	TemperatureReader& operator=(const TemperatureReader&) = delete;
+	~TemperatureReader() { UnmapFile(mapped); }
+};
+
+bool OpenTemperatureReader(TemperatureReader& reader, const string& file_name) {
+	UnmapFile(reader.mapped);
+	if (!MapFile(reader.mapped, file_name))
+	{
+		UnmapFile(reader.mapped);
+		return false;
+	}
+	reader.position = reader.mapped.data;
+	return true;
+}
+
+// Go back to the first row of the file (for another pass over the data)
+void RewindTemperatureReader(TemperatureReader& reader) {
+	reader.position = reader.mapped.data;
+}
+
+// Parse the temperatures of up to max_rows records from the current position. Returns the number of rows read (0 at the end of the file).
+size_t ReadTemperatures(TemperatureReader& reader, float* temperatures, size_t max_rows) {
+	size_t rows = 0;
+	const char* p = reader.position;
+	const char* end = reader.mapped.data + reader.mapped.size;
+	int year, month, day, time;
+
+	while (p < end && rows < max_rows)
+	{
+		const char* eol = (const char*)memchr(p, '\n', end - p);
+		if (!eol) eol = end;
+
+		if (IsRecord(p, eol))
+		{
+			const char* token;
+			size_t length;
+			const char* q = ScanToken(p, eol, token, length);
+			q = ScanInt(q, eol, year);
+			q = ScanInt(q, eol, month);
+			q = ScanInt(q, eol, day);
+			q = ScanInt(q, eol, time);
+			ScanFloat(q, eol, temperatures[rows]);
+			rows++;
+		}
+
+		p = eol + 1;
+	}
+
+	reader.position = min(p, end);
+	return rows;
+}
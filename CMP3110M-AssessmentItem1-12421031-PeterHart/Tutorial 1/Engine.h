@@ -0,0 +1,282 @@
+/* Engine.h | Reusable statistics engine: one context, program and queue shared by any number of data sets, with results as futures */
+
+#pragma once
+
+#include <vector>
+#include <string>
+#include <sstream>
+#include <memory>
+#include <future>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <chrono>
+#include <stdexcept>
+#include <algorithm>
+#include <CL/cl.hpp>
+#include "Utils.h"
+#include "DataLoader.h"
+#include "WeatherCache.h"
+#include "Statistics.h"
+#include "ProgramCache.h"
+#include "Summary.h"
+
+using namespace std;
+
+// Statistics of one data set, and profiling of its commands
+struct EngineResult {
+	string name;
+	size_t rows = 0;
+	Stats stats;
+	vector<uint64_t> cumulative;	// prefix sum of the histogram, which answers any percentile (see HistogramPercentile)
+	float first_quartile = 0.f;
+	float median = 0.f;
+	float third_quartile = 0.f;
+	unsigned long long kernel_ns = 0;
+	unsigned long long transfer_ns = 0;
+	cl_ulong device_start = 0;		// device clock, start of its first command and end of its last one
+	cl_ulong device_end = 0;
+	unsigned long long latency_ns = 0;	// from the submission to the result
+};
+
+// Parse a comma separated list of file names
+vector<string> ParseFileList(const string& list) {
+	vector<string> files;
+	stringstream items(list);
+	string item;
+
+	while (getline(items, item, ','))
+	{
+		if (!item.empty())
+			files.push_back(item);
+	}
+	return files;
+}
+
+// Statistics engine: the context, program, queue and kernels are set up once, then every submitted data set only
+// costs its own upload, fused statistics, histogram and two small reads. Nothing is waited for when submitting:
+// the commands of every data set go into the same queue back to back (concurrently on an out-of-order queue, where
+// the upload of one data set overlaps the kernels of another), and a completion thread fulfils each future as soon
+// as the reads of its data set are done.
+class StatsEngine {
+public:
+	StatsEngine(const cl::Context& engine_context, const cl::Program& engine_program) : context(engine_context), program(engine_program) {
+		Start();
+	}
+
+	// Set up the context and program of a device on its own (the program comes from the binary cache if it can)
+	StatsEngine(int platform_id, int device_id) {
+		bool from_cache = false;
+		context = GetContext(platform_id, device_id);
+		program = BuildProgram(context, "my_kernels.cl", "", from_cache);
+		Start();
+	}
+
+	// Waits for every data set still in flight
+	~StatsEngine() {
+		{
+			lock_guard<mutex> lock(guard);
+			stopping = true;
+		}
+		wake.notify_all();
+		completer.join();
+	}
+
+	StatsEngine(const StatsEngine&) = delete;
+	StatsEngine& operator=(const StatsEngine&) = delete;
+
+	bool OutOfOrder() const { return out_of_order; }
+
+	// Start the statistics of a column. A must stay valid until the future is ready.
+	future<EngineResult> Submit(const string& name, const float* A, size_t rows) {
+		return Enqueue(name, A, rows, nullptr);
+	}
+
+	// Same, for a loaded data set, which the engine keeps alive until its upload is done
+	future<EngineResult> Submit(const string& name, const shared_ptr<const WeatherData>& data) {
+		return Enqueue(name, data->temperature, data->rows, data);
+	}
+
+	// Load every file (from its binary cache if it is up to date, otherwise by parsing it) and submit each one as soon
+	// as it is loaded, so the next file is parsed while the device works on the previous ones. A file which cannot be
+	// loaded gets a future holding the error.
+	vector<future<EngineResult>> SubmitFiles(const vector<string>& file_names) {
+		vector<future<EngineResult>> results;
+		for (const string& file_name : file_names)
+		{
+			shared_ptr<WeatherData> data = make_shared<WeatherData>();
+			if (!LoadWeatherCache(file_name, *data) && !LoadWeatherData(file_name, *data))
+			{
+				promise<EngineResult> failed;
+				failed.set_exception(make_exception_ptr(runtime_error("cannot load " + file_name)));
+				results.push_back(failed.get_future());
+				continue;
+			}
+			results.push_back(Submit(file_name, shared_ptr<const WeatherData>(data)));
+		}
+		return results;
+	}
+
+private:
+	// Commands, buffers and result of one data set in flight
+	struct Job {
+		EngineResult result;
+		shared_ptr<const WeatherData> data;
+		promise<EngineResult> done;
+		chrono::high_resolution_clock::time_point submitted;
+
+		cl::Buffer buffer_A;
+		SummaryBuffers buffers;
+		vector<cl_uint> histogram;
+		vector<cl::Event> kernel_events;
+		vector<cl::Event> transfer_events;
+	};
+
+	void Start() {
+		device = context.getInfo<CL_CONTEXT_DEVICES>()[0];
+
+		// Every command is chained through events, so the data sets can run concurrently where the device allows it
+		try
+		{
+			queue = cl::CommandQueue(context, CL_QUEUE_PROFILING_ENABLE | CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE);
+			out_of_order = true;
+		}
+		catch (const cl::Error&)
+		{
+			queue = cl::CommandQueue(context, CL_QUEUE_PROFILING_ENABLE);
+		}
+
+		kernels = CreateSummaryKernels(program, device);
+
+		completer = thread([this]() { Complete(); });
+	}
+
+	future<EngineResult> Enqueue(const string& name, const float* A, size_t rows, const shared_ptr<const WeatherData>& data) {
+		shared_ptr<Job> job = make_shared<Job>();
+		job->result.name = name;
+		job->result.rows = rows;
+		job->data = data;
+		job->submitted = chrono::high_resolution_clock::now();
+		future<EngineResult> result = job->done.get_future();
+
+		if (rows == 0)
+		{
+			job->result.stats = EmptyStats();
+			job->done.set_value(job->result);
+			return result;
+		}
+
+		try
+		{
+			// The kernels are shared, and their arguments are captured when each command is enqueued
+			lock_guard<mutex> lock(submit_guard);
+
+			job->buffer_A = cl::Buffer(context, CL_MEM_READ_ONLY, rows * sizeof(float));
+			job->buffers = CreateSummaryBuffers(context, kernels, rows);
+			job->histogram.assign(HISTOGRAM_BINS, 0);
+
+			vector<cl::Event>& transfers = job->transfer_events;
+			transfers.resize(4);
+
+			queue.enqueueWriteBuffer(job->buffer_A, CL_FALSE, 0, rows * sizeof(float), A, NULL, &transfers[0]);
+			vector<cl::Event> uploaded = { transfers[0] };
+
+			cl::Event histogram_event;
+			EnqueueStatistics(queue, kernels, job->buffer_A, rows, job->buffers, uploaded, job->result.stats, job->kernel_events, transfers[2]);
+			EnqueueHistogram(queue, kernels, job->buffer_A, rows, job->buffers, uploaded, &job->histogram[0], transfers[1], histogram_event, transfers[3]);
+			job->kernel_events.push_back(histogram_event);
+
+			// Hand the commands to the device now, instead of when someone next waits
+			queue.flush();
+		}
+		catch (...)
+		{
+			// The commands enqueued before the failure still write into the job's buffers and host memory, so the job
+			// (the last reference to them) is only released once the queue has drained
+			exception_ptr error = current_exception();
+			try
+			{
+				queue.finish();
+			}
+			catch (const cl::Error&)
+			{
+			}
+			job->done.set_exception(error);
+			return result;
+		}
+
+		{
+			lock_guard<mutex> lock(guard);
+			pending.push_back(job);
+		}
+		wake.notify_all();
+		return result;
+	}
+
+	// Completion thread: wait for the reads of every data set in submission order, then fulfil its future
+	void Complete() {
+		for (;;)
+		{
+			shared_ptr<Job> job;
+			{
+				unique_lock<mutex> lock(guard);
+				wake.wait(lock, [this]() { return stopping || !pending.empty(); });
+				if (pending.empty())
+					return;
+				job = pending.front();
+				pending.pop_front();
+			}
+
+			try
+			{
+				cl::Event::waitForEvents(vector<cl::Event>{ job->transfer_events[2], job->transfer_events[3] });
+				EngineResult& result = job->result;
+				result.latency_ns = chrono::duration_cast<chrono::nanoseconds>(chrono::high_resolution_clock::now() - job->submitted).count();
+
+				result.cumulative = HistogramPrefixSum(job->histogram);
+				vector<size_t> ranks = OrderStatisticRanks(result.stats.count);
+				result.first_quartile = HistogramRankValue(result.cumulative, ranks[1]);
+				result.median = HistogramRankValue(result.cumulative, ranks[2]);
+				result.third_quartile = HistogramRankValue(result.cumulative, ranks[3]);
+
+				vector<cl::Event> events = job->kernel_events;
+				events.insert(events.end(), job->transfer_events.begin(), job->transfer_events.end());
+				result.device_start = events[0].getProfilingInfo<CL_PROFILING_COMMAND_START>();
+				for (auto& event : events)
+				{
+					cl_ulong start = event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+					cl_ulong end = event.getProfilingInfo<CL_PROFILING_COMMAND_END>();
+					result.device_start = min(result.device_start, start);
+					result.device_end = max(result.device_end, end);
+				}
+				for (auto& event : job->kernel_events)
+					result.kernel_ns += event.getProfilingInfo<CL_PROFILING_COMMAND_END>() - event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+				for (auto& event : job->transfer_events)
+					result.transfer_ns += event.getProfilingInfo<CL_PROFILING_COMMAND_END>() - event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+
+				job->done.set_value(result);
+			}
+			catch (...)
+			{
+				job->done.set_exception(current_exception());
+			}
+		}
+	}
+
+	cl::Context context;
+	cl::Program program;
+	cl::Device device;
+	cl::CommandQueue queue;
+	bool out_of_order = false;
+
+	SummaryKernels kernels;
+
+	// Data sets in flight, oldest first
+	mutex submit_guard;
+	mutex guard;
+	condition_variable wake;
+	deque<shared_ptr<Job>> pending;
+	bool stopping = false;
+	thread completer;
+};
@@ -0,0 +1,138 @@
+/* Filter.h | Row filters on the station and date/time columns, evaluated on the device (see row_matches in my_kernels.cl) */
+
+#pragma once
+
+#include <vector>
+#include <string>
+#include <sstream>
+#include <cstdint>
+#include <cstdlib>
+#include <algorithm>
+#include <CL/cl.hpp>
+#include "DataLoader.h"
+
+using namespace std;
+
+// A conjunction of conditions on a row: its station, any of the fields of its packed date/time (as a mask and a
+// value, see PackDateTime) and an inclusive date/time range. The default filter matches every row.
+struct RowFilter {
+	int station = -1;
+	uint32_t mask = 0;
+	uint32_t value = 0;
+	uint32_t from = 0;
+	uint32_t to = 0xFFFFFFFFu;
+};
+
+// Returns true if the filter matches every row
+inline bool IsEmptyFilter(const RowFilter& filter) {
+	return filter.station < 0 && filter.mask == 0 && filter.from == 0 && filter.to == 0xFFFFFFFFu;
+}
+
+// Host version of row_matches in my_kernels.cl
+inline bool RowMatches(const RowFilter& filter, uint16_t station_id, uint32_t date_time) {
+	return (filter.station < 0 || station_id == filter.station) && ((date_time & filter.mask) == filter.value) && date_time >= filter.from && date_time <= filter.to;
+}
+
+// Parse a date of the form YYYY, YYYY-MM or YYYY-MM-DD into the first (or, if last is set, the last) packed
+// date/time of that period. Returns false if it is not a date.
+bool ParseFilterDate(const string& text, bool last, uint32_t& date_time) {
+	int fields[3] = { 0, last ? 15 : 0, last ? 31 : 0 };
+	stringstream parts(text);
+	string part;
+	int count = 0;
+
+	while (getline(parts, part, '-'))
+	{
+		if (count == 3 || part.empty() || part.find_first_not_of("0123456789") != string::npos)
+			return false;
+		fields[count++] = atoi(part.c_str());
+	}
+
+	if (count == 0 || fields[0] >= (1 << 11))
+		return false;
+	date_time = PackDateTime(fields[0], fields[1] & 0xF, fields[2] & 0x1F, last ? 0xFFF : 0);
+	return true;
+}
+
+// Add one condition (station=NAME, year=Y, month=M, day=D, time=HHMM, from=DATE or to=DATE) to a filter.
+// Returns false, with the reason in error, if the condition cannot be parsed.
+bool ParseFilterTerm(const WeatherData& data, const string& term, RowFilter& filter, string& error) {
+	size_t equals = term.find('=');
+	if (equals == string::npos)
+	{
+		error = "expected name=value, got " + term;
+		return false;
+	}
+
+	string name = term.substr(0, equals);
+	string value = term.substr(equals + 1);
+
+	if (name == "station")
+	{
+		filter.station = FindStation(data, value);
+		if (filter.station < 0)
+		{
+			error = "unknown station " + value;
+			return false;
+		}
+		return true;
+	}
+
+	if (name == "from" || name == "to")
+	{
+		uint32_t date_time;
+		if (!ParseFilterDate(value, name == "to", date_time))
+		{
+			error = "expected a date (YYYY, YYYY-MM or YYYY-MM-DD), got " + value;
+			return false;
+		}
+		(name == "from" ? filter.from : filter.to) = date_time;
+		return true;
+	}
+
+	// Equality on one field of the packed date/time
+	uint32_t field_mask, shift;
+	if (name == "year") { field_mask = 0x7FF; shift = 21; }
+	else if (name == "month") { field_mask = 0xF; shift = 17; }
+	else if (name == "day") { field_mask = 0x1F; shift = 12; }
+	else if (name == "time") { field_mask = 0xFFF; shift = 0; }
+	else
+	{
+		error = "unknown filter " + name;
+		return false;
+	}
+
+	if (value.empty() || value.find_first_not_of("0123456789") != string::npos || (uint32_t)atoi(value.c_str()) > field_mask)
+	{
+		error = "invalid " + name + " " + value;
+		return false;
+	}
+
+	filter.mask |= field_mask << shift;
+	filter.value = (filter.value & ~(field_mask << shift)) | ((uint32_t)atoi(value.c_str()) << shift);
+	return true;
+}
+
+// Parse a list of conditions separated by commas or spaces (e.g. "station=X,year=2010")
+bool ParseFilter(const WeatherData& data, const string& list, RowFilter& filter, string& error) {
+	string terms = list;
+	replace(terms.begin(), terms.end(), ',', ' ');
+
+	stringstream items(terms);
+	string term;
+	while (items >> term)
+	{
+		if (!ParseFilterTerm(data, term, filter, error))
+			return false;
+	}
+	return true;
+}
+
+// Set the filter arguments of a kernel (station, mask, value, from, to), starting at argument first
+void SetFilterArgs(cl::Kernel& kernel, cl_uint first, const RowFilter& filter) {
+	kernel.setArg(first, (cl_int)filter.station);
+	kernel.setArg(first + 1, (cl_uint)filter.mask);
+	kernel.setArg(first + 2, (cl_uint)filter.value);
+	kernel.setArg(first + 3, (cl_uint)filter.from);
+	kernel.setArg(first + 4, (cl_uint)filter.to);
+}
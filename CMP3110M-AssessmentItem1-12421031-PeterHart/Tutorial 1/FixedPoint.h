@@ -0,0 +1,83 @@
+/* FixedPoint.h | Compact storage of the temperature column as 16-bit tenths of a degree, for the integer kernels in my_kernels.cl */
+
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <cstdint>
+#include <climits>
+#include <CL/cl.hpp>
+#include "Statistics.h"
+#include "DataLoader.h"
+#include "BitonicSort.h"
+
+using namespace std;
+
+// First bin of the histogram in tenths of a degree (the bins of the histogram kernel are exactly one tenth wide)
+const cl_int FIXED_HISTOGRAM_MIN = (cl_int)lround(HISTOGRAM_MIN * HISTOGRAM_BINS_PER_DEGREE);
+
+// Exact statistics of a fixed-point column, accumulated with atomics by reduce_statistics_fixed
+// The sums are 64-bit, split into 32-bit halves so that they only need the core 32-bit atomics.
+// Must match the layout of the FixedStats struct in my_kernels.cl
+struct FixedStats {
+	cl_uint count;
+	cl_int min;
+	cl_int max;
+	cl_uint sum_lo;
+	cl_uint sum_hi;
+	cl_uint squares_lo;
+	cl_uint squares_hi;
+};
+
+// Partial statistics of one work-item (local memory of reduce_statistics_fixed)
+// Must match the layout of the FixedPartial struct in my_kernels.cl
+struct FixedPartial {
+	cl_long sum;
+	cl_long squares;
+	cl_uint count;
+	cl_int min;
+	cl_int max;
+};
+
+// Initial value of the accumulator (nothing added yet)
+FixedStats EmptyFixedStats() {
+	FixedStats empty = { 0, INT_MAX, INT_MIN, 0, 0, 0, 0 };
+	return empty;
+}
+
+// Value of a reading stored in tenths (divided in double, like HistogramBinValue)
+inline float DecodeTenths(cl_short tenths) {
+	return (float)(tenths / 10.0);
+}
+
+// Encode a temperature column as tenths of a degree. Returns false if any value is not exactly a whole number
+// of tenths within the range of the encoding (the sentinel excluded), in which case the column must stay in floats.
+bool EncodeTenths(const float* A, size_t rows, PageVector<cl_short>& tenths) {
+	tenths.resize(rows);
+	for (size_t i = 0; i < rows; i++)
+	{
+		long value = lround(A[i] * 10.0);
+		if (value < SHRT_MIN || value >= FIXED_PAD || DecodeTenths((cl_short)value) != A[i])
+			return false;
+		tenths[i] = (cl_short)value;
+	}
+	return true;
+}
+
+// Statistics of a fixed-point column from its exact integer sums (rounded only once, when converted back to degrees)
+Stats FixedToStats(const FixedStats& fixed) {
+	Stats stats = EmptyStats();
+	if (fixed.count == 0)
+		return stats;
+
+	int64_t sum = (int64_t)(((uint64_t)fixed.sum_hi << 32) | fixed.sum_lo);
+	uint64_t squares = ((uint64_t)fixed.squares_hi << 32) | fixed.squares_lo;
+	double mean = (double)sum / fixed.count;
+
+	stats.count = fixed.count;
+	stats.mean = (float)(mean / 10.0);
+	stats.m2 = (float)max(((double)squares - (double)sum * mean) / 100.0, 0.0);
+	stats.min = DecodeTenths((cl_short)fixed.min);
+	stats.max = DecodeTenths((cl_short)fixed.max);
+	return stats;
+}
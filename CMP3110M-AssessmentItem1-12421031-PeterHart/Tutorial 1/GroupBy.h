@@ -0,0 +1,209 @@
+/* GroupBy.h | Statistics per station, per year or per station x month, computed on the device in one pass */
+
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstdint>
+#include <chrono>
+#include <CL/cl.hpp>
+#include "DataLoader.h"
+#include "Statistics.h"
+#include "BitonicSort.h"
+
+using namespace std;
+
+// Grouping of the rows. Must match the modes of group_keys in my_kernels.cl
+enum GroupMode {
+	GROUP_BY_STATION = 0,
+	GROUP_BY_YEAR = 1,
+	GROUP_BY_STATION_MONTH = 2
+};
+
+// Parse the name of a grouping (station, year or month, i.e. station x month). Returns false for an unknown name.
+bool ParseGroupMode(const string& name, GroupMode& mode) {
+	if (name == "station") mode = GROUP_BY_STATION;
+	else if (name == "year") mode = GROUP_BY_YEAR;
+	else if (name == "month") mode = GROUP_BY_STATION_MONTH;
+	else return false;
+	return true;
+}
+
+// Number of group ids a grouping can produce (group ids come straight from the encoded columns, see group_keys),
+// and the first of them. Years are counted from the first year in the data, so only the years it covers get a group.
+size_t GroupCount(const WeatherData& data, GroupMode mode, uint32_t& base) {
+	base = 0;
+	if (mode == GROUP_BY_STATION)
+		return data.stations.size();
+	if (mode == GROUP_BY_STATION_MONTH)
+		return data.stations.size() << 4;
+	if (data.rows == 0)
+		return 0;
+
+	int first_year = UnpackYear(data.dateTime[0]);
+	int last_year = first_year;
+	for (size_t row = 1; row < data.rows; row++)
+	{
+		int year = UnpackYear(data.dateTime[row]);
+		first_year = min(first_year, year);
+		last_year = max(last_year, year);
+	}
+	base = (uint32_t)first_year;
+	return (size_t)(last_year - first_year + 1);
+}
+
+// Printable name of a group
+string GroupLabel(const WeatherData& data, GroupMode mode, uint32_t group) {
+	if (mode == GROUP_BY_STATION)
+		return data.stations[group];
+	if (mode == GROUP_BY_YEAR)
+		return to_string(group);
+
+	char month[4];
+	snprintf(month, sizeof(month), "%02u", group & 0xF);
+	return data.stations[group >> 4] + " " + month;
+}
+
+// Statistics of one group
+struct GroupStats {
+	uint32_t group;
+	Stats stats;
+	float first_quartile;
+	float median;
+	float third_quartile;
+};
+
+// Statistics of every non-empty group (in group id order) and profiling of the run
+struct GroupByResult {
+	vector<GroupStats> groups;
+	size_t kernel_launches = 0;
+	unsigned long long kernel_ns = 0;
+	unsigned long long transfer_ns = 0;
+	unsigned long long wall_ns = 0;
+};
+
+// Compute the statistics of every group: each row gets a 64-bit key (group, temperature), one bitonic sort over the
+// keys gives one segment per group sorted by temperature, then one workgroup per group reduces its segment and reads
+// its quartiles by rank. sort_program must be built from my_kernels.cl with -D SORT_T=ulong.
+void GroupByStatistics(const cl::Context& context, const cl::Program& program, const cl::Program& sort_program, const WeatherData& data, GroupMode mode, GroupByResult& result) {
+	cl::Device device = context.getInfo<CL_CONTEXT_DEVICES>()[0];
+	cl::CommandQueue queue(context, CL_QUEUE_PROFILING_ENABLE);
+
+	size_t rows = data.rows;
+	uint32_t base;
+	size_t groups = GroupCount(data, mode, base);
+	if (rows == 0 || groups == 0)
+		return;
+
+	cl::Kernel keys_kernel = cl::Kernel(program, "group_keys");
+	cl::Kernel bounds_kernel = cl::Kernel(program, "segment_bounds");
+	cl::Kernel stats_kernel = cl::Kernel(program, "group_statistics");
+
+	// Largest power of two workgroup the sort kernels allow (each workgroup sorts blocks of 2 * local_size keys)
+	size_t sort_limit = min((size_t)256, cl::Kernel(sort_program, "bitonic_sort_local").getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device));
+	size_t sort_local = 1;
+	while (sort_local * 2 <= sort_limit)
+		sort_local *= 2;
+
+	size_t sort_elements = 2 * sort_local;
+	while (sort_elements < rows)
+		sort_elements *= 2;
+
+	size_t stats_local = min((size_t)256, stats_kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device));
+
+	cl::Buffer buffer_stations(context, CL_MEM_READ_ONLY, rows * sizeof(uint16_t));
+	cl::Buffer buffer_date_times(context, CL_MEM_READ_ONLY, rows * sizeof(uint32_t));
+	cl::Buffer buffer_A(context, CL_MEM_READ_ONLY, rows * sizeof(float));
+	cl::Buffer buffer_K(context, CL_MEM_READ_WRITE, sort_elements * sizeof(cl_ulong));
+	cl::Buffer buffer_start(context, CL_MEM_READ_WRITE, groups * sizeof(cl_uint));
+	cl::Buffer buffer_end(context, CL_MEM_READ_WRITE, groups * sizeof(cl_uint));
+	cl::Buffer buffer_S(context, CL_MEM_WRITE_ONLY, groups * sizeof(Stats));
+	cl::Buffer buffer_Q(context, CL_MEM_WRITE_ONLY, groups * 3 * sizeof(float));
+
+	vector<cl::Event> transfer_events(3), kernel_events;
+
+	auto group_start = chrono::high_resolution_clock::now();
+
+	// Upload the three columns the grouping needs (non-blocking)
+	queue.enqueueWriteBuffer(buffer_stations, CL_FALSE, 0, rows * sizeof(uint16_t), data.stationId, NULL, &transfer_events[0]);
+	queue.enqueueWriteBuffer(buffer_date_times, CL_FALSE, 0, rows * sizeof(uint32_t), data.dateTime, NULL, &transfer_events[1]);
+	queue.enqueueWriteBuffer(buffer_A, CL_FALSE, 0, rows * sizeof(float), data.temperature, NULL, &transfer_events[2]);
+	vector<cl::Event> wait = transfer_events;
+
+	// The padding keys are the largest possible key, so they sort after every group
+	if (sort_elements > rows)
+	{
+		cl::Event pad_event;
+		queue.enqueueFillBuffer(buffer_K, (cl_ulong)0xFFFFFFFFFFFFFFFFull, rows * sizeof(cl_ulong), (sort_elements - rows) * sizeof(cl_ulong), NULL, &pad_event);
+		wait.push_back(pad_event);
+	}
+
+	// Groups without rows keep an empty segment
+	cl::Event start_event, end_event;
+	queue.enqueueFillBuffer(buffer_start, (cl_uint)0, 0, groups * sizeof(cl_uint), NULL, &start_event);
+	queue.enqueueFillBuffer(buffer_end, (cl_uint)0, 0, groups * sizeof(cl_uint), NULL, &end_event);
+	wait.push_back(start_event);
+	wait.push_back(end_event);
+
+	keys_kernel.setArg(0, buffer_stations);
+	keys_kernel.setArg(1, buffer_date_times);
+	keys_kernel.setArg(2, buffer_A);
+	keys_kernel.setArg(3, buffer_K);
+	keys_kernel.setArg(4, (cl_int)rows);
+	keys_kernel.setArg(5, (cl_int)mode);
+	keys_kernel.setArg(6, (cl_uint)base);
+
+	kernel_events.push_back(cl::Event());
+	queue.enqueueNDRangeKernel(keys_kernel, cl::NullRange, cl::NDRange(rows), cl::NullRange, &wait, &kernel_events.back());
+	wait = { kernel_events.back() };
+
+	EnqueueBitonicSort(queue, sort_program, buffer_K, sizeof(cl_ulong), sort_elements, sort_local, wait, kernel_events);
+
+	bounds_kernel.setArg(0, buffer_K);
+	bounds_kernel.setArg(1, buffer_start);
+	bounds_kernel.setArg(2, buffer_end);
+	bounds_kernel.setArg(3, (cl_int)rows);
+
+	kernel_events.push_back(cl::Event());
+	queue.enqueueNDRangeKernel(bounds_kernel, cl::NullRange, cl::NDRange(rows), cl::NullRange, &wait, &kernel_events.back());
+	wait = { kernel_events.back() };
+
+	stats_kernel.setArg(0, buffer_K);
+	stats_kernel.setArg(1, buffer_start);
+	stats_kernel.setArg(2, buffer_end);
+	stats_kernel.setArg(3, buffer_S);
+	stats_kernel.setArg(4, buffer_Q);
+	stats_kernel.setArg(5, cl::Local(stats_local * sizeof(Stats)));
+
+	kernel_events.push_back(cl::Event());
+	queue.enqueueNDRangeKernel(stats_kernel, cl::NullRange, cl::NDRange(groups * stats_local), cl::NDRange(stats_local), &wait, &kernel_events.back());
+	wait = { kernel_events.back() };
+
+	// Only the per-group results cross the bus
+	vector<Stats> stats(groups);
+	vector<float> quartiles(groups * 3);
+	transfer_events.push_back(cl::Event());
+	queue.enqueueReadBuffer(buffer_S, CL_FALSE, 0, groups * sizeof(Stats), &stats[0], &wait, &transfer_events.back());
+	transfer_events.push_back(cl::Event());
+	queue.enqueueReadBuffer(buffer_Q, CL_FALSE, 0, groups * 3 * sizeof(float), &quartiles[0], &wait, &transfer_events.back());
+	cl::Event::waitForEvents(transfer_events);
+
+	auto group_end = chrono::high_resolution_clock::now();
+	result.wall_ns = chrono::duration_cast<chrono::nanoseconds>(group_end - group_start).count();
+
+	for (uint32_t group = 0; group < groups; group++)
+	{
+		if (stats[group].count == 0)
+			continue;
+
+		GroupStats group_stats = { base + group, stats[group], quartiles[group * 3], quartiles[group * 3 + 1], quartiles[group * 3 + 2] };
+		result.groups.push_back(group_stats);
+	}
+
+	for (auto& event : kernel_events)
+		result.kernel_ns += event.getProfilingInfo<CL_PROFILING_COMMAND_END>() - event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+	for (auto& event : transfer_events)
+		result.transfer_ns += event.getProfilingInfo<CL_PROFILING_COMMAND_END>() - event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+	result.kernel_launches = kernel_events.size();
+}
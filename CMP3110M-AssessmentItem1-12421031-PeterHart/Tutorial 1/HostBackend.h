@@ -0,0 +1,248 @@
+/* HostBackend.h | Native multi-threaded, vectorised host implementation of the statistics (baseline and fallback) */
+
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <algorithm>
+#include "Statistics.h"
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define HOST_SIMD_NAME "AVX"
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define HOST_SIMD_NAME "SSE2"
+#else
+#define HOST_SIMD_NAME "scalar"
+#endif
+
+using namespace std;
+
+// Fixed set of worker threads, which all run the same task (one call per thread, given the thread index)
+class HostThreadPool {
+public:
+	HostThreadPool(unsigned int nr_threads = 0) {
+		if (nr_threads == 0)
+			nr_threads = max(1u, thread::hardware_concurrency());
+
+		for (unsigned int t = 0; t < nr_threads; t++)
+			threads.emplace_back([this, t]() { Work(t); });
+	}
+
+	~HostThreadPool() {
+		{
+			lock_guard<mutex> lock(guard);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (auto& worker : threads)
+			worker.join();
+	}
+
+	HostThreadPool(const HostThreadPool&) = delete;
+	HostThreadPool& operator=(const HostThreadPool&) = delete;
+
+	unsigned int Size() const { return (unsigned int)threads.size(); }
+
+	// Run task(t) on every thread t and wait until all of them are done
+	void Run(const function<void(unsigned int)>& run_task) {
+		unique_lock<mutex> lock(guard);
+		task = run_task;
+		pending = Size();
+		generation++;
+		wake.notify_all();
+		done.wait(lock, [this]() { return pending == 0; });
+		task = nullptr;
+	}
+
+private:
+	void Work(unsigned int t) {
+		size_t seen = 0;
+		for (;;)
+		{
+			function<void(unsigned int)> current;
+			{
+				unique_lock<mutex> lock(guard);
+				wake.wait(lock, [&]() { return stopping || generation != seen; });
+				if (stopping)
+					return;
+				seen = generation;
+				current = task;
+			}
+
+			current(t);
+
+			lock_guard<mutex> lock(guard);
+			if (--pending == 0)
+				done.notify_one();
+		}
+	}
+
+	vector<thread> threads;
+	mutex guard;
+	condition_variable wake;
+	condition_variable done;
+	function<void(unsigned int)> task;
+	size_t generation = 0;
+	unsigned int pending = 0;
+	bool stopping = false;
+};
+
+// Range of rows [first, last) of thread t when n rows are split evenly over nr_threads threads
+inline void ThreadRange(size_t n, unsigned int t, unsigned int nr_threads, size_t& first, size_t& last) {
+	first = n / nr_threads * t + min((size_t)t, n % nr_threads);
+	last = first + n / nr_threads + (t < n % nr_threads ? 1 : 0);
+}
+
+// Statistics of a block of values that fits in the cache: sum, min and max in one vectorised pass, then the sum of
+// squared differences from the block mean in a second vectorised pass (exact per block, merged with MergeStats)
+Stats BlockStats(const float* A, size_t n) {
+	Stats block = EmptyStats();
+	if (n == 0)
+		return block;
+
+	size_t i = 0;
+	float sum = 0.f;
+	float low = block.min;
+	float high = block.max;
+
+#if defined(__AVX__)
+	__m256 sum8 = _mm256_setzero_ps();
+	__m256 min8 = _mm256_set1_ps(low);
+	__m256 max8 = _mm256_set1_ps(high);
+	for (; i + 8 <= n; i += 8)
+	{
+		__m256 x = _mm256_loadu_ps(A + i);
+		sum8 = _mm256_add_ps(sum8, x);
+		min8 = _mm256_min_ps(min8, x);
+		max8 = _mm256_max_ps(max8, x);
+	}
+	float lanes[3][8];
+	_mm256_storeu_ps(lanes[0], sum8);
+	_mm256_storeu_ps(lanes[1], min8);
+	_mm256_storeu_ps(lanes[2], max8);
+	for (int l = 0; l < 8; l++)
+	{
+		sum += lanes[0][l];
+		low = min(low, lanes[1][l]);
+		high = max(high, lanes[2][l]);
+	}
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	__m128 sum4 = _mm_setzero_ps();
+	__m128 min4 = _mm_set1_ps(low);
+	__m128 max4 = _mm_set1_ps(high);
+	for (; i + 4 <= n; i += 4)
+	{
+		__m128 x = _mm_loadu_ps(A + i);
+		sum4 = _mm_add_ps(sum4, x);
+		min4 = _mm_min_ps(min4, x);
+		max4 = _mm_max_ps(max4, x);
+	}
+	float lanes[3][4];
+	_mm_storeu_ps(lanes[0], sum4);
+	_mm_storeu_ps(lanes[1], min4);
+	_mm_storeu_ps(lanes[2], max4);
+	for (int l = 0; l < 4; l++)
+	{
+		sum += lanes[0][l];
+		low = min(low, lanes[1][l]);
+		high = max(high, lanes[2][l]);
+	}
+#endif
+	for (; i < n; i++)
+	{
+		sum += A[i];
+		low = min(low, A[i]);
+		high = max(high, A[i]);
+	}
+
+	float mean = sum / n;
+	float m2 = 0.f;
+	i = 0;
+
+#if defined(__AVX__)
+	__m256 mean8 = _mm256_set1_ps(mean);
+	__m256 m2_8 = _mm256_setzero_ps();
+	for (; i + 8 <= n; i += 8)
+	{
+		__m256 d = _mm256_sub_ps(_mm256_loadu_ps(A + i), mean8);
+		m2_8 = _mm256_add_ps(m2_8, _mm256_mul_ps(d, d));
+	}
+	_mm256_storeu_ps(lanes[0], m2_8);
+	for (int l = 0; l < 8; l++)
+		m2 += lanes[0][l];
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	__m128 mean4 = _mm_set1_ps(mean);
+	__m128 m2_4 = _mm_setzero_ps();
+	for (; i + 4 <= n; i += 4)
+	{
+		__m128 d = _mm_sub_ps(_mm_loadu_ps(A + i), mean4);
+		m2_4 = _mm_add_ps(m2_4, _mm_mul_ps(d, d));
+	}
+	_mm_storeu_ps(lanes[0], m2_4);
+	for (int l = 0; l < 4; l++)
+		m2 += lanes[0][l];
+#endif
+	for (; i < n; i++)
+		m2 += (A[i] - mean) * (A[i] - mean);
+
+	block.count = (uint32_t)n;
+	block.mean = mean;
+	block.m2 = m2;
+	block.min = low;
+	block.max = high;
+	return block;
+}
+
+// Statistics of the whole data: every thread merges the statistics of the blocks of its rows, then the
+// statistics of every thread are merged in order
+Stats HostStatistics(HostThreadPool& pool, const float* A, size_t n) {
+	const size_t block_size = 4096;
+	unsigned int nr_threads = pool.Size();
+	vector<Stats> partial(nr_threads, EmptyStats());
+
+	pool.Run([&](unsigned int t) {
+		size_t first, last;
+		ThreadRange(n, t, nr_threads, first, last);
+		for (size_t block = first; block < last; block += block_size)
+			partial[t] = MergeStats(partial[t], BlockStats(A + block, min(block_size, last - block)));
+	});
+
+	Stats stats = EmptyStats();
+	for (const Stats& thread_stats : partial)
+		stats = MergeStats(stats, thread_stats);
+	return stats;
+}
+
+// Parallel sort: every thread sorts its own run, then neighbouring runs are merged pairwise (in parallel) until one is left
+vector<float> HostSort(HostThreadPool& pool, const float* A, size_t n) {
+	unsigned int nr_threads = pool.Size();
+	vector<float> sorted(A, A + n);
+	vector<float> buffer(n);
+
+	// Run boundaries
+	vector<size_t> bounds(nr_threads + 1);
+	for (unsigned int t = 0; t < nr_threads; t++)
+		ThreadRange(n, t, nr_threads, bounds[t], bounds[t + 1]);
+
+	pool.Run([&](unsigned int t) { sort(sorted.begin() + bounds[t], sorted.begin() + bounds[t + 1]); });
+
+	for (size_t width = 1; width < nr_threads; width *= 2)
+	{
+		pool.Run([&](unsigned int t) {
+			size_t left = t * 2 * width;
+			if (left >= nr_threads)
+				return;
+			size_t middle = min(left + width, (size_t)nr_threads);
+			size_t right = min(left + 2 * width, (size_t)nr_threads);
+			merge(sorted.begin() + bounds[left], sorted.begin() + bounds[middle], sorted.begin() + bounds[middle], sorted.begin() + bounds[right], buffer.begin() + bounds[left]);
+		});
+		sorted.swap(buffer);
+	}
+
+	return sorted;
+}
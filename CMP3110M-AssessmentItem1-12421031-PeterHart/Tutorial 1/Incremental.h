@@ -0,0 +1,210 @@
+/* Incremental.h | Append-only updates: persisted mergeable statistics, so each run only processes the rows added since the last one */
+
+#pragma once
+
+#include <fstream>
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <chrono>
+#include <CL/cl.hpp>
+#include "DataLoader.h"
+#include "Statistics.h"
+#include "ProgramCache.h"
+#include "Summary.h"
+
+using namespace std;
+
+// Layout of a state file:
+//   header | histogram counts (uint64 per bin, same binning as the histogram kernel)
+// The statistics (64-bit count, double sum and M2) and the histogram are both mergeable, so the rows of the appended
+// tail are simply merged in, however long the file grows.
+const char INCREMENTAL_STATE_MAGIC[8] = { 'W', 'X', 'S', 'T', 'A', 'T', 'E', '\0' };
+const uint32_t INCREMENTAL_STATE_VERSION = 2;
+
+// Bytes before the processed offset which are hashed, to notice a file that was rewritten rather than appended to
+const uint64_t INCREMENTAL_CHECK_BYTES = 4096;
+
+struct IncrementalStateHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t bins;
+	uint64_t offset;
+	uint64_t check;
+	TotalStats stats;
+};
+
+// Everything a run needs to know about the rows processed so far
+struct IncrementalState {
+	uint64_t offset = 0;	// bytes of the file already processed (always the end of a complete line)
+	uint64_t check = 0;		// hash of the bytes just before offset
+	TotalStats stats = EmptyTotalStats();
+	vector<uint64_t> histogram = vector<uint64_t>(HISTOGRAM_BINS, 0);
+};
+
+// Result and profiling of one incremental run
+struct IncrementalResult {
+	bool reset = false;			// the state did not match the file, so every row was processed again
+	uint64_t rows_before = 0;
+	size_t new_rows = 0;
+	uint64_t bytes_parsed = 0;
+	unsigned long long parse_ns = 0;
+	unsigned long long kernel_ns = 0;
+	unsigned long long transfer_ns = 0;
+	unsigned long long wall_ns = 0;
+};
+
+// The state lives next to the text file it describes
+string GetStateFileName(const string& file_name) {
+	return file_name + ".state";
+}
+
+// Hash of the bytes of a file just before an offset
+uint64_t HashBeforeOffset(const char* data, uint64_t offset) {
+	uint64_t length = min(offset, INCREMENTAL_CHECK_BYTES);
+	return HashString(string(data + offset - length, (size_t)length));
+}
+
+// Read the state of a file. Returns false (leaving state untouched) if there is no valid state file.
+bool LoadIncrementalState(const string& file_name, IncrementalState& state) {
+	ifstream file(GetStateFileName(file_name), ios::binary);
+	if (!file)
+		return false;
+
+	IncrementalStateHeader header;
+	if (!file.read((char*)&header, sizeof(header)))
+		return false;
+
+	if (memcmp(header.magic, INCREMENTAL_STATE_MAGIC, sizeof(header.magic)) != 0 || header.version != INCREMENTAL_STATE_VERSION || header.bins != HISTOGRAM_BINS)
+		return false;
+
+	vector<uint64_t> histogram(HISTOGRAM_BINS);
+	if (!file.read((char*)histogram.data(), histogram.size() * sizeof(uint64_t)))
+		return false;
+
+	// Every row is counted by both the statistics and the histogram
+	uint64_t binned = 0;
+	for (uint64_t count : histogram)
+		binned += count;
+	if (binned != header.stats.count)
+		return false;
+
+	state.offset = header.offset;
+	state.check = header.check;
+	state.stats = header.stats;
+	state.histogram.swap(histogram);
+	return true;
+}
+
+// Write the state of a file. Returns false if the state file cannot be written.
+bool SaveIncrementalState(const string& file_name, const IncrementalState& state) {
+	IncrementalStateHeader header = {};
+	memcpy(header.magic, INCREMENTAL_STATE_MAGIC, sizeof(header.magic));
+	header.version = INCREMENTAL_STATE_VERSION;
+	header.bins = (uint32_t)state.histogram.size();
+	header.offset = state.offset;
+	header.check = state.check;
+	header.stats = state.stats;
+
+	// Write to a temporary file first, so that an interrupted run keeps the previous state
+	string state_name = GetStateFileName(file_name);
+	string temp_name = state_name + ".tmp";
+	ofstream file(temp_name, ios::binary | ios::trunc);
+	if (!file)
+		return false;
+
+	file.write((const char*)&header, sizeof(header));
+	file.write((const char*)state.histogram.data(), state.histogram.size() * sizeof(uint64_t));
+	file.close();
+	if (!file)
+	{
+		remove(temp_name.c_str());
+		return false;
+	}
+
+	remove(state_name.c_str());
+	return rename(temp_name.c_str(), state_name.c_str()) == 0;
+}
+
+// Statistics and histogram of a set of rows on the device (fused statistics kernels and histogram kernel, one upload)
+void DeviceSummary(const cl::Context& context, const cl::Program& program, const float* A, size_t rows, Stats& stats, vector<cl_uint>& histogram, IncrementalResult& result) {
+	cl::Device device = context.getInfo<CL_CONTEXT_DEVICES>()[0];
+	cl::CommandQueue queue(context, CL_QUEUE_PROFILING_ENABLE);
+
+	SummaryKernels kernels = CreateSummaryKernels(program, device);
+	SummaryBuffers buffers = CreateSummaryBuffers(context, kernels, rows);
+	cl::Buffer buffer_A(context, CL_MEM_READ_ONLY, rows * sizeof(float));
+
+	vector<cl::Event> transfer_events(4), kernel_events;
+	queue.enqueueWriteBuffer(buffer_A, CL_FALSE, 0, rows * sizeof(float), A, NULL, &transfer_events[0]);
+	vector<cl::Event> uploaded = { transfer_events[0] };
+
+	// Only the statistics and the bins cross the bus
+	histogram.assign(HISTOGRAM_BINS, 0);
+	cl::Event histogram_event;
+	EnqueueStatistics(queue, kernels, buffer_A, rows, buffers, uploaded, stats, kernel_events, transfer_events[1]);
+	EnqueueHistogram(queue, kernels, buffer_A, rows, buffers, uploaded, &histogram[0], transfer_events[2], histogram_event, transfer_events[3]);
+	kernel_events.push_back(histogram_event);
+	cl::Event::waitForEvents(transfer_events);
+
+	for (auto& event : kernel_events)
+		result.kernel_ns += event.getProfilingInfo<CL_PROFILING_COMMAND_END>() - event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+	for (auto& event : transfer_events)
+		result.transfer_ns += event.getProfilingInfo<CL_PROFILING_COMMAND_END>() - event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+}
+
+// Bring the state of a file up to date: parse only the complete lines appended after the processed offset, summarise
+// them on the device and merge them into the state. If the file no longer matches the state (it shrank, or the bytes
+// before the offset changed), the state is cleared and every row is processed again. Returns false if the file cannot be read.
+bool UpdateIncrementalState(const cl::Context& context, const cl::Program& program, const string& file_name, IncrementalState& state, IncrementalResult& result) {
+	auto update_start = chrono::high_resolution_clock::now();
+
+	TemperatureReader reader;
+	if (!OpenTemperatureReader(reader, file_name))
+		return false;
+
+	const char* data = reader.mapped.data;
+	uint64_t size = reader.mapped.size;
+
+	if (state.offset > size || (state.offset && HashBeforeOffset(data, state.offset) != state.check))
+	{
+		state = IncrementalState();
+		result.reset = true;
+	}
+	result.rows_before = state.stats.count;
+
+	// Only complete lines are processed, a line still being written is left for the next run
+	uint64_t end = state.offset;
+	for (uint64_t p = size; p > state.offset; p--)
+	{
+		if (data[p - 1] == '\n')
+		{
+			end = p;
+			break;
+		}
+	}
+
+	vector<float> tail(CountRecords(data + state.offset, data + end));
+	reader.position = data + state.offset;
+	result.new_rows = tail.empty() ? 0 : ReadTemperatures(reader, &tail[0], tail.size());
+	result.bytes_parsed = end - state.offset;
+	result.parse_ns = chrono::duration_cast<chrono::nanoseconds>(chrono::high_resolution_clock::now() - update_start).count();
+
+	if (result.new_rows)
+	{
+		Stats tail_stats;
+		vector<cl_uint> tail_histogram;
+		DeviceSummary(context, program, &tail[0], result.new_rows, tail_stats, tail_histogram, result);
+
+		state.stats = MergeTotalStats(state.stats, WidenStats(tail_stats));
+		for (size_t b = 0; b < state.histogram.size(); b++)
+			state.histogram[b] += tail_histogram[b];
+	}
+
+	state.offset = end;
+	state.check = end ? HashBeforeOffset(data, end) : 0;
+	result.wall_ns = chrono::duration_cast<chrono::nanoseconds>(chrono::high_resolution_clock::now() - update_start).count();
+	return true;
+}
@@ -0,0 +1,229 @@
+/* MultiDevice.h | Split the data across every device (and NUMA sub-device) of a platform, then merge on the host */
+
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <chrono>
+#include <functional>
+#include <algorithm>
+#include <CL/cl.hpp>
+#include "Statistics.h"
+#include "ProgramCache.h"
+#include "BitonicSort.h"
+#include "Summary.h"
+
+using namespace std;
+
+// One device taking part in a multi-device run, with its own context, queue and program
+struct DeviceWorker {
+	cl::Device device;
+	string name;
+	bool sub_device = false;
+	cl::Context context;
+	cl::CommandQueue queue;
+	cl::Program program;
+
+	// Calibration throughput, and the partition of the rows it processes
+	double rows_per_s = 0.0;
+	size_t first = 0;
+	size_t rows = 0;
+
+	// Results and profiling of its partition
+	Stats stats;
+	vector<float> sorted;
+	vector<cl::Event> kernel_events;
+	vector<cl::Event> transfer_events;
+
+	// Kept alive until the commands using them are done
+	cl::Buffer buffer_S;
+	SummaryBuffers summary_buffers;
+};
+
+// Every device of a platform. CPU devices are split into one sub-device per NUMA node (device fission),
+// when the runtime supports it, so that each node works on its own partition in its own memory.
+vector<DeviceWorker> GetDeviceWorkers(int platform_id) {
+	vector<cl::Platform> platforms;
+	cl::Platform::get(&platforms);
+
+	vector<cl::Device> devices;
+	platforms[platform_id].getDevices((cl_device_type)CL_DEVICE_TYPE_ALL, &devices);
+
+	vector<DeviceWorker> workers;
+	for (cl::Device& device : devices)
+	{
+		vector<cl::Device> sub_devices;
+
+		if (device.getInfo<CL_DEVICE_TYPE>() & CL_DEVICE_TYPE_CPU)
+		{
+			vector<cl_device_partition_property> partitions = device.getInfo<CL_DEVICE_PARTITION_PROPERTIES>();
+			bool by_domain = find(partitions.begin(), partitions.end(), (cl_device_partition_property)CL_DEVICE_PARTITION_BY_AFFINITY_DOMAIN) != partitions.end();
+
+			if (by_domain && (device.getInfo<CL_DEVICE_PARTITION_AFFINITY_DOMAIN>() & CL_DEVICE_AFFINITY_DOMAIN_NUMA))
+			{
+				cl_device_partition_property properties[] = { CL_DEVICE_PARTITION_BY_AFFINITY_DOMAIN, CL_DEVICE_AFFINITY_DOMAIN_NUMA, 0 };
+				try
+				{
+					device.createSubDevices(properties, &sub_devices);
+				}
+				catch (const cl::Error&)
+				{
+					sub_devices.clear();
+				}
+			}
+		}
+
+		// A single NUMA node is no better than the whole device
+		if (sub_devices.size() < 2)
+			sub_devices = { device };
+
+		for (size_t i = 0; i < sub_devices.size(); i++)
+		{
+			DeviceWorker worker;
+			worker.device = sub_devices[i];
+			worker.sub_device = sub_devices.size() > 1;
+			worker.name = device.getInfo<CL_DEVICE_NAME>();
+			if (worker.sub_device)
+				worker.name += " (NUMA node " + to_string(i) + ")";
+			workers.push_back(worker);
+		}
+	}
+
+	return workers;
+}
+
+// Enqueue the fused statistics and the bitonic sort of rows [first, first + rows) of A on one device (non-blocking)
+// The partition is uploaded once into a power of two buffer: the statistics read it first, then it is sorted in place.
+void EnqueuePartition(DeviceWorker& worker, const float* A, size_t first, size_t rows) {
+	worker.kernel_events.clear();
+	worker.transfer_events.clear();
+	worker.sorted.assign(rows, 0.f);
+	if (rows == 0)
+	{
+		worker.stats = EmptyStats();
+		return;
+	}
+
+	SummaryKernels summary = CreateSummaryKernels(worker.program, worker.device);
+
+	// Largest power of two workgroup the sort kernels allow
+	size_t sort_limit = min((size_t)256, cl::Kernel(worker.program, "bitonic_sort_local").getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(worker.device));
+	size_t sort_local = 1;
+	while (sort_local * 2 <= sort_limit)
+		sort_local *= 2;
+
+	size_t sort_elements = 2 * sort_local;
+	while (sort_elements < rows)
+		sort_elements *= 2;
+
+	worker.buffer_S = cl::Buffer(worker.context, CL_MEM_READ_WRITE, sort_elements * sizeof(float));
+	worker.summary_buffers = CreateSummaryBuffers(worker.context, summary, rows, false);
+
+	worker.transfer_events.push_back(cl::Event());
+	worker.queue.enqueueWriteBuffer(worker.buffer_S, CL_FALSE, 0, rows * sizeof(float), A + first, NULL, &worker.transfer_events.back());
+	vector<cl::Event> wait = { worker.transfer_events.back() };
+
+	worker.transfer_events.push_back(cl::Event());
+	EnqueueStatistics(worker.queue, summary, worker.buffer_S, rows, worker.summary_buffers, wait, worker.stats, worker.kernel_events, worker.transfer_events.back());
+
+	// The sort overwrites the partition, so it waits for the reduction (which reads it), not for the combine
+	wait = { worker.kernel_events[worker.kernel_events.size() - 2] };
+
+	// The padding sorts last (same neutral value as the single device sort), and is never read back
+	if (sort_elements > rows)
+	{
+		cl::Event pad_event;
+		worker.queue.enqueueFillBuffer(worker.buffer_S, SORT_PAD, rows * sizeof(float), (sort_elements - rows) * sizeof(float), NULL, &pad_event);
+		wait.push_back(pad_event);
+	}
+
+	EnqueueBitonicSort(worker.queue, worker.program, worker.buffer_S, sizeof(float), sort_elements, sort_local, wait, worker.kernel_events);
+
+	worker.transfer_events.push_back(cl::Event());
+	worker.queue.enqueueReadBuffer(worker.buffer_S, CL_FALSE, 0, rows * sizeof(float), &worker.sorted[0], &wait, &worker.transfer_events.back());
+	worker.queue.flush();
+}
+
+// Wait for every command of a worker
+void WaitPartition(DeviceWorker& worker) {
+	if (!worker.transfer_events.empty())
+		cl::Event::waitForEvents(worker.transfer_events);
+}
+
+// Set up every worker (context, queue, program) and time a short run of the real work on a sample of the data.
+// Each device then gets a share of the rows proportional to its throughput, so that uneven devices finish together.
+void CalibrateDeviceWorkers(vector<DeviceWorker>& workers, const float* A, size_t rows, size_t sample_rows) {
+	sample_rows = min(sample_rows, rows);
+	double total_rate = 0.0;
+
+	for (DeviceWorker& worker : workers)
+	{
+		worker.context = cl::Context({ worker.device });
+		worker.queue = cl::CommandQueue(worker.context, CL_QUEUE_PROFILING_ENABLE);
+		bool from_cache;
+		worker.program = BuildProgram(worker.context, "my_kernels.cl", "", from_cache);
+
+		// The first run warms up the device (first launch of each kernel), the second one is timed
+		EnqueuePartition(worker, A, 0, sample_rows);
+		WaitPartition(worker);
+
+		auto start = chrono::high_resolution_clock::now();
+		EnqueuePartition(worker, A, 0, sample_rows);
+		WaitPartition(worker);
+		auto end = chrono::high_resolution_clock::now();
+
+		double seconds = chrono::duration_cast<chrono::nanoseconds>(end - start).count() * 1e-9;
+		worker.rows_per_s = seconds > 0.0 ? sample_rows / seconds : 1.0;
+		total_rate += worker.rows_per_s;
+	}
+
+	// Contiguous partitions, weighted by throughput (the last device takes the remainder)
+	size_t first = 0;
+	for (size_t i = 0; i < workers.size(); i++)
+	{
+		size_t share = (i + 1 == workers.size()) ? rows - first : (size_t)(rows * (workers[i].rows_per_s / total_rate));
+		workers[i].first = first;
+		workers[i].rows = min(share, rows - first);
+		first += workers[i].rows;
+	}
+}
+
+// Order-preserving mapping of a float onto an unsigned integer key (same as float_to_key in my_kernels.cl)
+inline uint32_t RunKey(float value) {
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	return (bits & 0x80000000u) ? ~bits : (bits | 0x80000000u);
+}
+
+// Value at each (0-based) rank of the sorted runs of every worker taken together, without merging them: a binary
+// search over the keys of the values, counting the values of every run at or below a key (k binary searches per step)
+vector<float> SelectRanksFromRuns(const vector<DeviceWorker>& workers, const vector<size_t>& ranks) {
+	auto key_below = [](uint32_t key, float value) { return key < RunKey(value); };
+
+	vector<float> values;
+	for (size_t rank : ranks)
+	{
+		// Smallest key with more than rank values at or below it, which is always the key of a value of some run
+		uint32_t lo = 0, hi = 0xFFFFFFFFu;
+		while (lo < hi)
+		{
+			uint32_t mid = lo + (hi - lo) / 2;
+			size_t count = 0;
+			for (const DeviceWorker& worker : workers)
+				count += upper_bound(worker.sorted.begin(), worker.sorted.end(), mid, key_below) - worker.sorted.begin();
+
+			if (count > rank)
+				hi = mid;
+			else
+				lo = mid + 1;
+		}
+
+		uint32_t bits = (lo & 0x80000000u) ? (lo & 0x7FFFFFFFu) : ~lo;
+		float value;
+		memcpy(&value, &bits, sizeof(value));
+		values.push_back(value);
+	}
+	return values;
+}
@@ -0,0 +1,142 @@
+/* ProgramCache.h | On-disk cache of compiled device binaries, so repeat runs skip the OpenCL compiler */
+
+#pragma once
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstdint>
+#include <CL/cl.hpp>
+
+using namespace std;
+
+// Read a whole kernel source file (empty if the file cannot be opened)
+string ReadKernelSource(const string& file_name) {
+	ifstream file(file_name, ios::binary);
+	return string(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+}
+
+// 64-bit FNV-1a hash, used to key the cached binaries
+uint64_t HashString(const string& text, uint64_t hash = 14695981039346656037ull) {
+	for (unsigned char c : text)
+	{
+		hash ^= c;
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+// Name of the cached binary of a program: a hash of everything the compiled code depends on
+// (kernel source, build options, platform, device and driver), so any change simply misses the cache
+string GetProgramCacheFileName(const string& source_file, const string& source, const string& options, const cl::Device& device) {
+	cl::Platform platform(device.getInfo<CL_DEVICE_PLATFORM>());
+
+	uint64_t hash = HashString(source);
+	hash = HashString(options, hash);
+	hash = HashString(platform.getInfo<CL_PLATFORM_NAME>(), hash);
+	hash = HashString(platform.getInfo<CL_PLATFORM_VERSION>(), hash);
+	hash = HashString(device.getInfo<CL_DEVICE_NAME>(), hash);
+	hash = HashString(device.getInfo<CL_DEVICE_VERSION>(), hash);
+	hash = HashString(device.getInfo<CL_DRIVER_VERSION>(), hash);
+
+	stringstream name;
+	name << source_file << "." << hex << setw(16) << setfill('0') << hash << ".bin";
+	return name.str();
+}
+
+// Create and build a program from a cached binary. Returns false (leaving program untouched) if there is
+// no cached binary, or if the runtime rejects it, in which case the caller builds from source instead.
+bool LoadProgramBinary(const cl::Context& context, const string& cache_file, const string& options, cl::Program& program) {
+	ifstream file(cache_file, ios::binary);
+	if (!file)
+		return false;
+
+	string binary((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+	if (binary.empty())
+		return false;
+
+	vector<cl::Device> devices = context.getInfo<CL_CONTEXT_DEVICES>();
+	cl::Program::Binaries binaries(1, make_pair((const void*)binary.data(), binary.size()));
+
+	try
+	{
+		cl::Program cached(context, { devices[0] }, binaries);
+		cached.build({ devices[0] }, options.c_str());
+		program = cached;
+	}
+	catch (const cl::Error&)
+	{
+		return false;
+	}
+	return true;
+}
+
+// Write the binary of a freshly built program to the cache. Returns false if the binary cannot be written.
+bool SaveProgramBinary(const cl::Program& program, const string& cache_file) {
+	// The binary is fetched through the C API, since the runtime writes it into buffers owned by the caller
+	size_t binary_size = 0;
+	if (clGetProgramInfo(program(), CL_PROGRAM_BINARY_SIZES, sizeof(binary_size), &binary_size, NULL) != CL_SUCCESS || binary_size == 0)
+		return false;
+
+	vector<char> binary(binary_size);
+	char* binary_data = binary.data();
+	if (clGetProgramInfo(program(), CL_PROGRAM_BINARIES, sizeof(binary_data), &binary_data, NULL) != CL_SUCCESS)
+		return false;
+
+	// Write to a temporary file first, so that an interrupted run never leaves a truncated binary behind
+	string temp_name = cache_file + ".tmp";
+	ofstream file(temp_name, ios::binary | ios::trunc);
+	if (!file)
+		return false;
+
+	file.write(binary.data(), binary.size());
+	file.close();
+	if (!file)
+	{
+		remove(temp_name.c_str());
+		return false;
+	}
+
+	remove(cache_file.c_str());
+	return rename(temp_name.c_str(), cache_file.c_str()) == 0;
+}
+
+// Create the program of a kernel source file for the device of the context, from its cached binary if there is a
+// matching one, otherwise by building the source (the binary is then cached for the next run)
+cl::Program BuildProgram(const cl::Context& context, const string& kernel_file, const string& options, bool& from_cache) {
+	cl::Device device = context.getInfo<CL_CONTEXT_DEVICES>()[0];
+	string kernel_source = ReadKernelSource(kernel_file);
+	string binary_file = GetProgramCacheFileName(kernel_file, kernel_source, options, device);
+
+	cl::Program program;
+	from_cache = LoadProgramBinary(context, binary_file, options, program);
+	if (from_cache)
+		return program;
+
+	cl::Program::Sources sources;
+	sources.push_back(make_pair(kernel_source.c_str(), kernel_source.length() + 1));
+	program = cl::Program(context, sources);
+
+	// Build and debug the kernel code currently residing on the device
+	try
+	{
+		program.build(options.c_str());
+	}
+	catch (const cl::Error& err)
+	{
+		cout << "Build Status: " << program.getBuildInfo<CL_PROGRAM_BUILD_STATUS>(device) << endl;
+		cout << "Build Options:\t" << program.getBuildInfo<CL_PROGRAM_BUILD_OPTIONS>(device) << endl;
+		cout << "Build Log:\t " << program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device) << endl;
+		throw err;
+	}
+
+	// Keep the compiled binary, so that the next run can skip the compiler
+	if (!SaveProgramBinary(program, binary_file))
+		cout << "Could not write the program binary cache file (" << binary_file << ")" << endl;
+
+	return program;
+}
@@ -0,0 +1,232 @@
+/* QueryServer.h | Resident query server: the context, program and data stay loaded, and each query only runs its kernels */
+
+#pragma once
+
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <cmath>
+#include <cstdlib>
+#include <chrono>
+#include <CL/cl.hpp>
+#include "DataLoader.h"
+#include "Statistics.h"
+#include "Filter.h"
+#include "Summary.h"
+
+using namespace std;
+
+// Everything that stays resident between queries
+struct QueryServer {
+	cl::Context context;
+	cl::Device device;
+	cl::CommandQueue queue;
+	cl::Program program;
+	const WeatherData* data = nullptr;
+
+	// The columns the queries read, uploaded once
+	cl::Buffer buffer_stations;
+	cl::Buffer buffer_date_times;
+	cl::Buffer buffer_A;
+	cl::Buffer buffer_histogram;
+	cl::Kernel histogram_kernel;
+	size_t histogram_local = 1;
+	size_t histogram_groups = 1;
+
+	// Exact statistics of the rows matching a filter (reduce_statistics_where, then combine_statistics)
+	SummaryKernels filtered;
+	SummaryBuffers filtered_buffers;
+
+	// Answer of the unfiltered query, computed once at startup (fused statistics and histogram)
+	Stats stats;
+	vector<uint64_t> cumulative;
+
+	// Latency of every query so far
+	size_t queries = 0;
+	unsigned long long total_ns = 0;
+};
+
+// Histogram of the rows matching a filter (one launch of histogram_where over the resident columns)
+vector<uint32_t> QueryHistogram(QueryServer& server, const RowFilter& filter) {
+	size_t histogram_size = HISTOGRAM_BINS * sizeof(cl_uint);
+	SetFilterArgs(server.histogram_kernel, 9, filter);
+
+	cl::Event clear_event, exe_event, read_event;
+	server.queue.enqueueFillBuffer(server.buffer_histogram, (cl_uint)0, 0, histogram_size, NULL, &clear_event);
+	vector<cl::Event> wait = { clear_event };
+	server.queue.enqueueNDRangeKernel(server.histogram_kernel, cl::NullRange, cl::NDRange(server.histogram_groups * server.histogram_local), cl::NDRange(server.histogram_local), &wait, &exe_event);
+
+	vector<uint32_t> histogram(HISTOGRAM_BINS);
+	wait = { exe_event };
+	server.queue.enqueueReadBuffer(server.buffer_histogram, CL_TRUE, 0, histogram_size, &histogram[0], &wait, &read_event);
+	return histogram;
+}
+
+// Exact statistics of the rows matching a filter (one launch of the filtered fused statistics over the resident columns)
+Stats QueryStatistics(QueryServer& server, const RowFilter& filter) {
+	SetFilterArgs(server.filtered.reduce, 6, filter);
+
+	Stats stats;
+	vector<cl::Event> kernel_events;
+	cl::Event read_event;
+	EnqueueStatistics(server.queue, server.filtered, server.buffer_A, server.data->rows, server.filtered_buffers, vector<cl::Event>(), stats, kernel_events, read_event);
+	read_event.wait();
+	return stats;
+}
+
+// Upload the columns and compute the unfiltered answer. Must be called once before any query.
+void StartQueryServer(QueryServer& server, const cl::Context& context, const cl::Program& program, const WeatherData& data) {
+	server.context = context;
+	server.device = context.getInfo<CL_CONTEXT_DEVICES>()[0];
+	server.queue = cl::CommandQueue(context);
+	server.program = program;
+	server.data = &data;
+
+	size_t rows = data.rows;
+	server.buffer_stations = cl::Buffer(context, CL_MEM_READ_ONLY, rows * sizeof(uint16_t));
+	server.buffer_date_times = cl::Buffer(context, CL_MEM_READ_ONLY, rows * sizeof(uint32_t));
+	server.buffer_A = cl::Buffer(context, CL_MEM_READ_ONLY, rows * sizeof(float));
+	server.buffer_histogram = cl::Buffer(context, CL_MEM_READ_WRITE, HISTOGRAM_BINS * sizeof(cl_uint));
+
+	server.queue.enqueueWriteBuffer(server.buffer_stations, CL_FALSE, 0, rows * sizeof(uint16_t), data.stationId);
+	server.queue.enqueueWriteBuffer(server.buffer_date_times, CL_FALSE, 0, rows * sizeof(uint32_t), data.dateTime);
+	server.queue.enqueueWriteBuffer(server.buffer_A, CL_FALSE, 0, rows * sizeof(float), data.temperature);
+
+	server.histogram_kernel = cl::Kernel(program, "histogram_where");
+	server.histogram_local = min((size_t)256, server.histogram_kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(server.device));
+	server.histogram_groups = max((size_t)1, min((rows + server.histogram_local - 1) / server.histogram_local, (size_t)server.device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>() * 4));
+
+	server.histogram_kernel.setArg(0, server.buffer_stations);
+	server.histogram_kernel.setArg(1, server.buffer_date_times);
+	server.histogram_kernel.setArg(2, server.buffer_A);
+	server.histogram_kernel.setArg(3, server.buffer_histogram);
+	server.histogram_kernel.setArg(4, cl::Local(HISTOGRAM_BINS * sizeof(cl_uint)));
+	server.histogram_kernel.setArg(5, (cl_int)rows);
+	server.histogram_kernel.setArg(6, (cl_int)HISTOGRAM_BINS);
+	server.histogram_kernel.setArg(7, HISTOGRAM_MIN);
+	server.histogram_kernel.setArg(8, HISTOGRAM_RESOLUTION);
+
+	// Exact statistics of the whole data (the filtered queries take theirs from QueryStatistics)
+	SummaryKernels kernels = CreateSummaryKernels(program, server.device);
+	SummaryBuffers buffers = CreateSummaryBuffers(context, kernels, rows, false);
+	vector<cl::Event> stats_events;
+	cl::Event stats_read_event;
+	EnqueueStatistics(server.queue, kernels, server.buffer_A, rows, buffers, vector<cl::Event>(), server.stats, stats_events, stats_read_event);
+	stats_read_event.wait();
+
+	// The filtered statistics share the launch of the fused statistics, with the columns after its own arguments
+	server.filtered = kernels;
+	server.filtered.reduce = cl::Kernel(program, "reduce_statistics_where");
+	server.filtered.stats_local = min((size_t)256, server.filtered.reduce.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(server.device));
+	server.filtered.reduce.setArg(4, server.buffer_stations);
+	server.filtered.reduce.setArg(5, server.buffer_date_times);
+	server.filtered_buffers = CreateSummaryBuffers(context, server.filtered, rows, false);
+
+	server.cumulative = HistogramPrefixSum(QueryHistogram(server, RowFilter()));
+}
+
+// Answer one request line. Requests:
+//   stats [filters]               count, mean, standard deviation, min, max and quartiles
+//   percentile P [filters]        value at a percentile (P from 0 to 100, as with -q)
+//   help, quit
+// Filters are name=value conditions, see ParseFilterTerm (e.g. "stats station=X year=2010").
+// Answers are one line, starting with "ok" or "error".
+string AnswerQuery(QueryServer& server, const string& line, bool& quit) {
+	stringstream request(line);
+	string command;
+	request >> command;
+
+	if (command.empty())
+		return "";
+	if (command == "quit" || command == "exit")
+	{
+		quit = true;
+		return "ok bye";
+	}
+	if (command == "help")
+		return "ok requests: stats [filters] | percentile P (0 to 100) [filters] | quit; filters: station=NAME year=Y month=M day=D time=HHMM from=DATE to=DATE";
+
+	double percentile = 0.0;
+	if (command == "percentile")
+	{
+		string value;
+		request >> value;
+		char* end = nullptr;
+		percentile = strtod(value.c_str(), &end);
+		if (value.empty() || *end != '\0' || percentile < 0.0 || percentile > 100.0)
+			return "error expected a percentile from 0 to 100, got " + value;
+	}
+	else if (command != "stats")
+	{
+		return "error unknown request " + command + " (try help)";
+	}
+
+	RowFilter filter;
+	string term, error;
+	while (request >> term)
+	{
+		if (!ParseFilterTerm(*server.data, term, filter, error))
+			return "error " + error;
+	}
+
+	// The unfiltered answer is resident. A filtered one costs a launch of the filtered statistics (exact, like the
+	// unfiltered ones) and one of the histogram, which only answers the quantiles.
+	Stats stats = server.stats;
+	vector<uint64_t> filtered;
+	const vector<uint64_t>* cumulative = &server.cumulative;
+	if (!IsEmptyFilter(filter))
+	{
+		stats = QueryStatistics(server, filter);
+		vector<uint32_t> histogram = QueryHistogram(server, filter);
+		filtered = HistogramPrefixSum(histogram);
+		cumulative = &filtered;
+	}
+
+	stringstream answer;
+	if (command == "percentile")
+	{
+		if (stats.count == 0)
+			return "ok count=0";
+		answer << "ok count=" << stats.count << " value=" << HistogramPercentile(*cumulative, percentile);
+		return answer.str();
+	}
+
+	answer << "ok count=" << stats.count;
+	if (stats.count)
+	{
+		vector<size_t> ranks = OrderStatisticRanks(stats.count);
+		answer << " mean=" << stats.mean << " stddev=" << sqrt(StatsVariance(stats)) << " min=" << stats.min << " max=" << stats.max
+			<< " q1=" << HistogramRankValue(*cumulative, ranks[1]) << " median=" << HistogramRankValue(*cumulative, ranks[2]) << " q3=" << HistogramRankValue(*cumulative, ranks[3]);
+	}
+	return answer.str();
+}
+
+// Answer requests, one per line, until quit or the end of the input. Every answer ends with the latency of its query.
+void RunQueryServer(QueryServer& server, istream& in, ostream& out) {
+	string line;
+	bool quit = false;
+
+	while (!quit && getline(in, line))
+	{
+		auto query_start = chrono::high_resolution_clock::now();
+		string answer;
+		try
+		{
+			answer = AnswerQuery(server, line, quit);
+		}
+		catch (const cl::Error& err)
+		{
+			answer = string("error ") + err.what();
+		}
+		auto query_end = chrono::high_resolution_clock::now();
+
+		if (answer.empty())
+			continue;
+
+		unsigned long long query_ns = chrono::duration_cast<chrono::nanoseconds>(query_end - query_start).count();
+		server.queries++;
+		server.total_ns += query_ns;
+		out << answer << " latency_us=" << query_ns / 1000 << endl;
+	}
+}
@@ -0,0 +1,233 @@
+/* Rolling.h | Rolling-window mean and standard deviation of every station, from prefix sums computed on the device */
+
+#pragma once
+
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <algorithm>
+#include <CL/cl.hpp>
+#include "DataLoader.h"
+#include "BitonicSort.h"
+#include "Compaction.h"
+
+using namespace std;
+
+// Layout of a rolling series file:
+//   header | window lengths (int32 days) | station id column (uint16) | packed date/time column (uint32)
+//   | temperature column (float) | mean and standard deviation columns (float) of every window, in turn
+// Rows are ordered by station, then date/time.
+const char ROLLING_FILE_MAGIC[8] = { 'W', 'X', 'R', 'O', 'L', 'L', '\0', '\0' };
+const uint32_t ROLLING_FILE_VERSION = 1;
+
+struct RollingFileHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t windows;
+	uint64_t rows;
+};
+
+// Rolling statistics of every reading and profiling of the run
+struct RollingResult {
+	vector<int> window_days;
+	vector<cl_ulong> keys;			// sorted key of every reading (see rolling_keys in my_kernels.cl)
+	vector<vector<float>> mean;		// of every window, for every reading
+	vector<vector<float>> stddev;
+	size_t kernel_launches = 0;
+	unsigned long long kernel_ns = 0;
+	unsigned long long transfer_ns = 0;
+	unsigned long long wall_ns = 0;
+};
+
+// Columns of a sorted key
+inline uint16_t RollingKeyStation(cl_ulong key) { return (uint16_t)(key >> 48); }
+inline uint32_t RollingKeyDateTime(cl_ulong key) { return (uint32_t)(key >> 16); }
+inline float RollingKeyTemperature(cl_ulong key) { return ((int)(key & 0xFFFF) - 32768) / 10.f; }
+
+// Parse a comma separated list of window lengths in days (e.g. "7,30"), ignoring anything that is not a positive number
+vector<int> ParseWindowDays(const char* list) {
+	vector<int> days;
+	stringstream items(list);
+	string item;
+
+	while (getline(items, item, ','))
+	{
+		int window = atoi(item.c_str());
+		if (window > 0)
+			days.push_back(window);
+	}
+	return days;
+}
+
+// Compute the rolling mean and standard deviation of every reading over each window (in days): sort the readings by
+// station and date/time (one 64-bit key per reading, which also carries the temperature in tenths), scan the values and
+// squared values into exact 64-bit prefix sums, then each window of each reading costs a binary search for its first
+// reading and two differences. program must be built from my_kernels.cl with -D SORT_T=ulong -D SCAN_T=long.
+void RollingStatistics(const cl::Context& context, const cl::Program& program, const WeatherData& data, const vector<int>& window_days, RollingResult& result) {
+	cl::Device device = context.getInfo<CL_CONTEXT_DEVICES>()[0];
+	cl::CommandQueue queue(context, CL_QUEUE_PROFILING_ENABLE);
+
+	size_t rows = data.rows;
+	result.window_days = window_days;
+	if (rows == 0)
+		return;
+
+	// Largest power of two workgroup the sort kernels allow
+	size_t sort_limit = min((size_t)256, cl::Kernel(program, "bitonic_sort_local").getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device));
+	size_t sort_local = 1;
+	while (sort_local * 2 <= sort_limit)
+		sort_local *= 2;
+
+	size_t sort_elements = 2 * sort_local;
+	while (sort_elements < rows)
+		sort_elements *= 2;
+
+	// The scans hold one more element than the rows, so that the sum of rows [j, i] is P[i + 1] - P[j]
+	size_t scan_local = ScanLocalSize(program, device);
+	size_t scan_elements = (rows + 1 + 2 * scan_local - 1) / (2 * scan_local) * (2 * scan_local);
+
+	cl::Buffer buffer_stations(context, CL_MEM_READ_ONLY, rows * sizeof(uint16_t));
+	cl::Buffer buffer_date_times(context, CL_MEM_READ_ONLY, rows * sizeof(uint32_t));
+	cl::Buffer buffer_A(context, CL_MEM_READ_ONLY, rows * sizeof(float));
+	cl::Buffer buffer_K(context, CL_MEM_READ_WRITE, sort_elements * sizeof(cl_ulong));
+	cl::Buffer buffer_T(context, CL_MEM_READ_WRITE, rows * sizeof(cl_int));
+	cl::Buffer buffer_V(context, CL_MEM_READ_WRITE, scan_elements * sizeof(cl_long));
+	cl::Buffer buffer_Q(context, CL_MEM_READ_WRITE, scan_elements * sizeof(cl_long));
+	vector<cl::Buffer> buffer_M, buffer_S, scan_sums;
+
+	vector<cl::Event> transfer_events(3), kernel_events;
+
+	auto rolling_start = chrono::high_resolution_clock::now();
+
+	queue.enqueueWriteBuffer(buffer_stations, CL_FALSE, 0, rows * sizeof(uint16_t), data.stationId, NULL, &transfer_events[0]);
+	queue.enqueueWriteBuffer(buffer_date_times, CL_FALSE, 0, rows * sizeof(uint32_t), data.dateTime, NULL, &transfer_events[1]);
+	queue.enqueueWriteBuffer(buffer_A, CL_FALSE, 0, rows * sizeof(float), data.temperature, NULL, &transfer_events[2]);
+	vector<cl::Event> wait = transfer_events;
+
+	// The padding keys are the largest possible key, so they sort after every reading
+	if (sort_elements > rows)
+	{
+		cl::Event pad_event;
+		queue.enqueueFillBuffer(buffer_K, (cl_ulong)0xFFFFFFFFFFFFFFFFull, rows * sizeof(cl_ulong), (sort_elements - rows) * sizeof(cl_ulong), NULL, &pad_event);
+		wait.push_back(pad_event);
+	}
+
+	cl::Kernel keys_kernel = cl::Kernel(program, "rolling_keys");
+	keys_kernel.setArg(0, buffer_stations);
+	keys_kernel.setArg(1, buffer_date_times);
+	keys_kernel.setArg(2, buffer_A);
+	keys_kernel.setArg(3, buffer_K);
+	keys_kernel.setArg(4, (cl_int)rows);
+
+	kernel_events.push_back(cl::Event());
+	queue.enqueueNDRangeKernel(keys_kernel, cl::NullRange, cl::NDRange(rows), cl::NullRange, &wait, &kernel_events.back());
+	wait = { kernel_events.back() };
+
+	EnqueueBitonicSort(queue, program, buffer_K, sizeof(cl_ulong), sort_elements, sort_local, wait, kernel_events);
+	vector<cl::Event> sorted = wait;
+
+	cl::Kernel prepare_kernel = cl::Kernel(program, "rolling_prepare");
+	prepare_kernel.setArg(0, buffer_K);
+	prepare_kernel.setArg(1, buffer_T);
+	prepare_kernel.setArg(2, buffer_V);
+	prepare_kernel.setArg(3, buffer_Q);
+	prepare_kernel.setArg(4, (cl_int)rows);
+
+	kernel_events.push_back(cl::Event());
+	queue.enqueueNDRangeKernel(prepare_kernel, cl::NullRange, cl::NDRange(scan_elements), cl::NullRange, &wait, &kernel_events.back());
+	vector<cl::Event> values_wait = { kernel_events.back() };
+	vector<cl::Event> squares_wait = values_wait;
+
+	// The two scans are independent of each other
+	EnqueueExclusiveScan(context, queue, program, buffer_V, sizeof(cl_long), scan_elements, scan_local, scan_sums, values_wait, kernel_events);
+	EnqueueExclusiveScan(context, queue, program, buffer_Q, sizeof(cl_long), scan_elements, scan_local, scan_sums, squares_wait, kernel_events);
+	vector<cl::Event> scanned = values_wait;
+	scanned.insert(scanned.end(), squares_wait.begin(), squares_wait.end());
+
+	// One launch per window
+	cl::Kernel window_kernel = cl::Kernel(program, "rolling_window");
+	result.mean.assign(window_days.size(), vector<float>(rows));
+	result.stddev.assign(window_days.size(), vector<float>(rows));
+	for (size_t w = 0; w < window_days.size(); w++)
+	{
+		buffer_M.push_back(cl::Buffer(context, CL_MEM_WRITE_ONLY, rows * sizeof(float)));
+		buffer_S.push_back(cl::Buffer(context, CL_MEM_WRITE_ONLY, rows * sizeof(float)));
+
+		window_kernel.setArg(0, buffer_K);
+		window_kernel.setArg(1, buffer_T);
+		window_kernel.setArg(2, buffer_V);
+		window_kernel.setArg(3, buffer_Q);
+		window_kernel.setArg(4, buffer_M[w]);
+		window_kernel.setArg(5, buffer_S[w]);
+		window_kernel.setArg(6, (cl_int)rows);
+		window_kernel.setArg(7, (cl_int)(window_days[w] * 1440));
+
+		kernel_events.push_back(cl::Event());
+		queue.enqueueNDRangeKernel(window_kernel, cl::NullRange, cl::NDRange(rows), cl::NullRange, &scanned, &kernel_events.back());
+		vector<cl::Event> window_done = { kernel_events.back() };
+
+		transfer_events.push_back(cl::Event());
+		queue.enqueueReadBuffer(buffer_M[w], CL_FALSE, 0, rows * sizeof(float), &result.mean[w][0], &window_done, &transfer_events.back());
+		transfer_events.push_back(cl::Event());
+		queue.enqueueReadBuffer(buffer_S[w], CL_FALSE, 0, rows * sizeof(float), &result.stddev[w][0], &window_done, &transfer_events.back());
+	}
+
+	// The sorted keys carry the station, date/time and temperature of every row of the series
+	result.keys.resize(rows);
+	transfer_events.push_back(cl::Event());
+	queue.enqueueReadBuffer(buffer_K, CL_FALSE, 0, rows * sizeof(cl_ulong), &result.keys[0], &sorted, &transfer_events.back());
+	cl::Event::waitForEvents(transfer_events);
+
+	auto rolling_end = chrono::high_resolution_clock::now();
+	result.wall_ns = chrono::duration_cast<chrono::nanoseconds>(rolling_end - rolling_start).count();
+
+	for (auto& event : kernel_events)
+		result.kernel_ns += event.getProfilingInfo<CL_PROFILING_COMMAND_END>() - event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+	for (auto& event : transfer_events)
+		result.transfer_ns += event.getProfilingInfo<CL_PROFILING_COMMAND_END>() - event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+	result.kernel_launches = kernel_events.size();
+}
+
+// Write the rolling series to a binary file (see RollingFileHeader). Returns false if the file cannot be written.
+bool WriteRollingFile(const string& file_name, const RollingResult& result) {
+	size_t rows = result.keys.size();
+	vector<uint16_t> stations(rows);
+	vector<uint32_t> date_times(rows);
+	vector<float> temperatures(rows);
+	for (size_t i = 0; i < rows; i++)
+	{
+		stations[i] = RollingKeyStation(result.keys[i]);
+		date_times[i] = RollingKeyDateTime(result.keys[i]);
+		temperatures[i] = RollingKeyTemperature(result.keys[i]);
+	}
+
+	RollingFileHeader header = {};
+	memcpy(header.magic, ROLLING_FILE_MAGIC, sizeof(header.magic));
+	header.version = ROLLING_FILE_VERSION;
+	header.windows = (uint32_t)result.window_days.size();
+	header.rows = rows;
+
+	ofstream file(file_name, ios::binary | ios::trunc);
+	if (!file)
+		return false;
+
+	vector<int32_t> window_days(result.window_days.begin(), result.window_days.end());
+	file.write((const char*)&header, sizeof(header));
+	file.write((const char*)window_days.data(), window_days.size() * sizeof(int32_t));
+	file.write((const char*)stations.data(), rows * sizeof(uint16_t));
+	file.write((const char*)date_times.data(), rows * sizeof(uint32_t));
+	file.write((const char*)temperatures.data(), rows * sizeof(float));
+	for (size_t w = 0; w < result.window_days.size(); w++)
+	{
+		file.write((const char*)result.mean[w].data(), rows * sizeof(float));
+		file.write((const char*)result.stddev[w].data(), rows * sizeof(float));
+	}
+
+	file.close();
+	return !file.fail();
+}
@@ -0,0 +1,243 @@
+/* Sketch.h | Mergeable approximate-quantile sketch (KLL), of constant size whatever the number of rows */
+
+#pragma once
+
+#include <fstream>
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include "Statistics.h"
+
+using namespace std;
+
+// Layout of a sketch file:
+//   header (with the summary statistics of the same rows, so that every result of a merged run covers them all)
+//   | for every level: item count (uint64) and items (float)
+const char SKETCH_FILE_MAGIC[8] = { 'W', 'X', 'S', 'K', 'E', 'T', 'C', 'H' };
+const uint32_t SKETCH_FILE_VERSION = 3;
+
+// Probability that the error of a rank exceeds the reported bound
+const double SKETCH_FAILURE = 0.01;
+
+// Capacity of the top level for a relative rank error (the bound of SketchRankError stays within about 6.5 / k
+// of the rows), and the smallest capacity of any level
+const double SKETCH_CAPACITY_FACTOR = 6.5;
+const size_t SKETCH_MIN_CAPACITY = 2;
+
+// Chunk size of the streaming mode when the sketch is asked for without one
+const size_t SKETCH_CHUNK_ROWS = 1 << 20;
+
+struct SketchFileHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t levels;
+	uint64_t k;
+	uint64_t count;
+	double error_squares;
+	uint64_t random;
+	TotalStats stats;
+};
+
+// Items of level h each stand for 2^h rows. When a level overflows its capacity it is compacted: sorted, then every
+// other item (from a random first one) moves up a level. A compaction of level h moves the rank of any value by 0 or
+// +-2^h with equal probability, so the squares of those weights bound the error of every rank (see SketchRankError).
+struct QuantileSketch {
+	double error = 0.0;				// relative rank error the capacity was chosen for (not saved with the sketch)
+	size_t k = 0;
+	uint64_t count = 0;				// rows summarised (the total weight of the items)
+	double error_squares = 0.0;		// sum of the squared weights of every compaction, on the host or the device
+	uint64_t random = 0x9E3779B97F4A7C15ull;
+	vector<vector<float>> levels;
+};
+
+QuantileSketch EmptySketch(double error) {
+	QuantileSketch sketch;
+	sketch.error = error;
+	sketch.k = max((size_t)ceil(SKETCH_CAPACITY_FACTOR / error), (size_t)8);
+	return sketch;
+}
+
+// Next pseudo-random number of the sketch (xorshift64)
+uint64_t SketchRandom(QuantileSketch& sketch) {
+	sketch.random ^= sketch.random << 13;
+	sketch.random ^= sketch.random >> 7;
+	sketch.random ^= sketch.random << 17;
+	return sketch.random;
+}
+
+// Capacity of a level, shrinking by 2/3 per level below the top one
+size_t SketchLevelCapacity(const QuantileSketch& sketch, size_t level) {
+	size_t depth = sketch.levels.size() - 1 - level;
+	return max((size_t)ceil(sketch.k * pow(2.0 / 3.0, (double)depth)), SKETCH_MIN_CAPACITY);
+}
+
+// Compact every level over its capacity, lowest first
+void CompressSketch(QuantileSketch& sketch) {
+	for (size_t h = 0; h < sketch.levels.size(); h++)
+	{
+		if (sketch.levels[h].size() <= SketchLevelCapacity(sketch, h))
+			continue;
+
+		if (h + 1 == sketch.levels.size())
+			sketch.levels.emplace_back();
+
+		// With an odd number of items, the largest one stays behind
+		vector<float>& level = sketch.levels[h];
+		sort(level.begin(), level.end());
+		size_t pairs = level.size() / 2;
+		size_t first = SketchRandom(sketch) & 1;
+		for (size_t i = 0; i < pairs; i++)
+			sketch.levels[h + 1].push_back(level[2 * i + first]);
+		level.erase(level.begin(), level.begin() + 2 * pairs);
+
+		double weight = ldexp(1.0, (int)h);
+		sketch.error_squares += weight * weight;
+	}
+}
+
+// Add items of weight 2^level. compactions are the compactions that produced them outside the sketch
+// (the sorted blocks of sketch_compact in my_kernels.cl), each moving a rank by less than 2^level.
+void SketchAdd(QuantileSketch& sketch, const float* items, size_t n, int level, size_t compactions) {
+	if (sketch.levels.size() <= (size_t)level)
+		sketch.levels.resize(level + 1);
+
+	sketch.levels[level].insert(sketch.levels[level].end(), items, items + n);
+	sketch.count += (uint64_t)n << level;
+
+	double weight = ldexp(1.0, level);
+	sketch.error_squares += compactions * weight * weight;
+
+	CompressSketch(sketch);
+}
+
+// Merge another sketch in (e.g. of another chunk or another run), keeping the capacity of this one
+void MergeSketch(QuantileSketch& sketch, const QuantileSketch& other) {
+	if (sketch.levels.size() < other.levels.size())
+		sketch.levels.resize(other.levels.size());
+
+	for (size_t h = 0; h < other.levels.size(); h++)
+		sketch.levels[h].insert(sketch.levels[h].end(), other.levels[h].begin(), other.levels[h].end());
+	sketch.count += other.count;
+	sketch.error_squares += other.error_squares;
+
+	CompressSketch(sketch);
+}
+
+// Items held by the sketch
+size_t SketchItems(const QuantileSketch& sketch) {
+	size_t items = 0;
+	for (const vector<float>& level : sketch.levels)
+		items += level.size();
+	return items;
+}
+
+// Bound of the error of any one (0-based) rank, in rows, holding with probability 1 - SKETCH_FAILURE
+// (Hoeffding/Azuma over the compactions, every one of which moves a rank by at most its weight)
+double SketchRankError(const QuantileSketch& sketch) {
+	return sqrt(2.0 * sketch.error_squares * log(2.0 / SKETCH_FAILURE));
+}
+
+// Level at which to sample sorted blocks of block rows (see sketch_compact in my_kernels.cl), so that the compactions
+// of a chunk of rows use at most a quarter of the squared error bound of that chunk at this relative error
+int SketchBlockLevel(double error, size_t rows, size_t block) {
+	double limit = error * error * rows * block / (4.0 * 2.0 * log(2.0 / SKETCH_FAILURE));
+	int level = 0;
+	while (((size_t)2 << level) <= block && ldexp(1.0, 2 * (level + 1)) <= limit)
+		level++;
+	return level;
+}
+
+// Value at a (0-based) rank of the summarised data (see OrderStatisticRanks)
+float SketchRankValue(const QuantileSketch& sketch, uint64_t rank) {
+	vector<pair<float, uint64_t>> items;
+	for (size_t h = 0; h < sketch.levels.size(); h++)
+	{
+		for (float item : sketch.levels[h])
+			items.push_back(make_pair(item, (uint64_t)1 << h));
+	}
+	if (items.empty())
+		return 0.f;
+
+	sort(items.begin(), items.end());
+	uint64_t cumulative = 0;
+	for (const auto& item : items)
+	{
+		cumulative += item.second;
+		if (cumulative > rank)
+			return item.first;
+	}
+	return items.back().first;
+}
+
+// Read a sketch file and the statistics of its rows. Returns false (leaving both untouched) if there is no valid sketch file.
+bool LoadSketch(const string& file_name, QuantileSketch& sketch, TotalStats& stats) {
+	ifstream file(file_name, ios::binary);
+	if (!file)
+		return false;
+
+	SketchFileHeader header;
+	if (!file.read((char*)&header, sizeof(header)))
+		return false;
+
+	if (memcmp(header.magic, SKETCH_FILE_MAGIC, sizeof(header.magic)) != 0 || header.version != SKETCH_FILE_VERSION || header.k == 0 || header.stats.count != header.count)
+		return false;
+
+	vector<vector<float>> levels(header.levels);
+	for (vector<float>& level : levels)
+	{
+		uint64_t items;
+		if (!file.read((char*)&items, sizeof(items)) || items > header.count)
+			return false;
+		level.resize((size_t)items);
+		if (!file.read((char*)level.data(), level.size() * sizeof(float)))
+			return false;
+	}
+
+	sketch.k = (size_t)header.k;
+	sketch.count = header.count;
+	sketch.error_squares = header.error_squares;
+	sketch.random = header.random;
+	sketch.levels.swap(levels);
+	stats = header.stats;
+	return true;
+}
+
+// Write a sketch file with the statistics of the same rows. Returns false if the file cannot be written.
+bool SaveSketch(const string& file_name, const QuantileSketch& sketch, const TotalStats& stats) {
+	SketchFileHeader header = {};
+	memcpy(header.magic, SKETCH_FILE_MAGIC, sizeof(header.magic));
+	header.version = SKETCH_FILE_VERSION;
+	header.levels = (uint32_t)sketch.levels.size();
+	header.k = sketch.k;
+	header.count = sketch.count;
+	header.error_squares = sketch.error_squares;
+	header.random = sketch.random;
+	header.stats = stats;
+
+	// Write to a temporary file first, so that an interrupted run keeps the previous sketch
+	string temp_name = file_name + ".tmp";
+	ofstream file(temp_name, ios::binary | ios::trunc);
+	if (!file)
+		return false;
+
+	file.write((const char*)&header, sizeof(header));
+	for (const vector<float>& level : sketch.levels)
+	{
+		uint64_t items = level.size();
+		file.write((const char*)&items, sizeof(items));
+		file.write((const char*)level.data(), level.size() * sizeof(float));
+	}
+	file.close();
+	if (!file)
+	{
+		remove(temp_name.c_str());
+		return false;
+	}
+
+	remove(file_name.c_str());
+	return rename(temp_name.c_str(), file_name.c_str()) == 0;
+}
@@ -8,113 +8,1077 @@
 #include <vector>
 #include <string>
 #include <cmath>
+#include <chrono>
+#include <iomanip>
 #include <CL/cl.hpp>
 #include "Utils.h"
+#include "DataLoader.h"
+#include "WeatherCache.h"
+#include "Statistics.h"
+#include "Streaming.h"
+#include "ProgramCache.h"
+#include "BitonicSort.h"
+#include "GroupBy.h"
+#include "MultiDevice.h"
+#include "HostBackend.h"
+#include "Benchmark.h"
+#include "Trace.h"
+#include "Incremental.h"
+#include "QueryServer.h"
+#include "Compaction.h"
+#include "Rolling.h"
+#include "FixedPoint.h"
+#include "Autotune.h"
+#include "Engine.h"
+#include "ZeroCopy.h"
+#include "Sketch.h"
+#include "Summary.h"
 #include <algorithm>
 
 using namespace std;
 
 void print_help();
 vector<float> quickDelete(vector<float>, float);
+float keyToFloat(unsigned int);
+vector<double> parsePercentiles(const char*);
 
 int main(int argc, char **argv)
 {
 	int platform_id = 0;
 	int device_id = 0;
+	string sort_kernel = "bitonic";
+	bool out_of_order = false;
+	size_t chunk_rows = 0;
+	string group_by;
+	vector<double> percentiles = { 5, 25, 50, 75, 95 };
+	string distribution_file;
+	bool multi_device = false;
+	bool host_backend = false;
+	bool benchmark = false;
+	BenchmarkConfig benchmark_config;
+	string trace_file;
+	bool incremental = false;
+	bool query_server = false;
+	string filter_text;
+	vector<int> rolling_windows;
+	bool fixed_point = false;
+	bool autotune = false;
+	vector<string> batch_files;
+	bool zero_copy = false;
+	double sketch_error = 0.0;
+	string sketch_file;
+	string given_flags;
+
+	/////////////////////////////////////////////////////////////////////////////////////////////////////////
+	////////////////////////////////// User Interface for Device Selection //////////////////////////////////
+	/////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	for (int i = 1; i < argc; i++)	
+	{
+		// Every flag given, for the compatibility checks below (the values of the flags are skipped along with them)
+		if (argv[i][0] == '-' && argv[i][1] && !argv[i][2])
+			given_flags += argv[i][1];
+
+		if ((strcmp(argv[i], "-p") == 0) && (i < (argc - 1))) { platform_id = atoi(argv[++i]); }
+		else if ((strcmp(argv[i], "-d") == 0) && (i < (argc - 1))) { device_id = atoi(argv[++i]); }
+		else if ((strcmp(argv[i], "-s") == 0) && (i < (argc - 1))) { sort_kernel = argv[++i]; }
+		else if (strcmp(argv[i], "-o") == 0) { out_of_order = true; }
+		else if (strcmp(argv[i], "-m") == 0) { multi_device = true; }
+		else if (strcmp(argv[i], "-n") == 0) { host_backend = true; }
+		else if (strcmp(argv[i], "-a") == 0) { incremental = true; }
+		else if (strcmp(argv[i], "-S") == 0) { query_server = true; }
+		else if (strcmp(argv[i], "-i") == 0) { fixed_point = true; }
+		else if (strcmp(argv[i], "-T") == 0) { autotune = true; }
+		else if (strcmp(argv[i], "-z") == 0) { zero_copy = true; }
+		else if ((strcmp(argv[i], "-B") == 0) && (i < (argc - 1)))
+		{
+			benchmark = true;
+			if (strcmp(argv[++i], "default") != 0)
+				benchmark_config.sizes = ParseBenchmarkSizes(argv[i]);
+		}
+		else if ((strcmp(argv[i], "-r") == 0) && (i < (argc - 1))) { benchmark_config.repetitions = max(1, atoi(argv[++i])); }
+		else if ((strcmp(argv[i], "-w") == 0) && (i < (argc - 1))) { benchmark_config.warmup = max(0, atoi(argv[++i])); }
+		else if ((strcmp(argv[i], "-F") == 0) && (i < (argc - 1))) { benchmark_config.format = (strcmp(argv[++i], "json") == 0) ? "json" : "csv"; }
+		else if ((strcmp(argv[i], "-c") == 0) && (i < (argc - 1))) { chunk_rows = strtoull(argv[++i], NULL, 10); }
+		else if ((strcmp(argv[i], "-g") == 0) && (i < (argc - 1))) { group_by = argv[++i]; }
+		else if ((strcmp(argv[i], "-q") == 0) && (i < (argc - 1))) { percentiles = parsePercentiles(argv[++i]); }
+		else if ((strcmp(argv[i], "-H") == 0) && (i < (argc - 1))) { distribution_file = argv[++i]; }
+		else if ((strcmp(argv[i], "-t") == 0) && (i < (argc - 1))) { trace_file = argv[++i]; }
+		else if ((strcmp(argv[i], "-f") == 0) && (i < (argc - 1))) { filter_text = argv[++i]; }
+		else if ((strcmp(argv[i], "-R") == 0) && (i < (argc - 1))) { rolling_windows = ParseWindowDays(argv[++i]); }
+		else if ((strcmp(argv[i], "-b") == 0) && (i < (argc - 1))) { batch_files = ParseFileList(argv[++i]); }
+		else if ((strcmp(argv[i], "-k") == 0) && (i < (argc - 1))) { sketch_error = atof(argv[++i]); }
+		else if ((strcmp(argv[i], "-K") == 0) && (i < (argc - 1))) { sketch_file = argv[++i]; }
+		else if (strcmp(argv[i], "-l") == 0) { cout << ListPlatformsDevices() << endl; }
+		else if (strcmp(argv[i], "-h") == 0) { print_help(); }
+	}
+
+	// The approximate quantiles need a relative rank error, and are merged with a sketch file only along with one
+	if ((given_flags.find('k') != string::npos && (sketch_error <= 0.0 || sketch_error >= 1.0)) || (!sketch_file.empty() && sketch_error == 0.0))
+	{
+		cout << "The approximate quantiles need a relative rank error between 0 and 1 (e.g. -k 0.01)" << endl;
+		getchar();
+		return 1;
+	}
+
+	// Every mode and option, with the flags it can be combined with (-p, -d, -l and -h go with any). A flag missing
+	// from the companions of another one would be ignored by its mode, so the combination is rejected instead.
+	// Checked before the sketch switches streaming on, so that a message names the flags actually given.
+	struct ModeFlag {
+		char flag;
+		const char* name;
+		const char* companions;
+	};
+	const ModeFlag mode_flags[] = {
+		{ 'B', "The benchmark mode", "rwF" },
+		{ 'r', "The repetitions", "BTwF" },
+		{ 'w', "The warm-up runs", "BTrF" },
+		{ 'F', "The benchmark output format", "Brw" },
+		{ 'T', "The autotune mode", "rw" },
+		{ 'a', "The incremental mode", "q" },
+		{ 'b', "The batch mode", "" },
+		{ 'S', "The query server", "" },		// takes its filters and percentiles with each request instead
+		{ 'c', "The streaming mode", "kK" },
+		{ 'k', "The approximate quantiles", "cK" },	// built over a stream
+		{ 'K', "The sketch file", "ck" },
+		{ 'g', "The group-by mode", "" },
+		{ 'm', "The multi-device mode", "" },
+		{ 'n', "The host backend", "" },
+		{ 'R', "The rolling-window mode", "" },
+		// Options of the single device pipeline (the integer kernels do not cover the predicate pushdown)
+		{ 'o', "The out-of-order queue", "sqHtfiz" },
+		{ 's', "The sort kernel", "oqHtfiz" },
+		{ 'q', "The percentiles", "aosHtfiz" },
+		{ 'H', "The distribution file", "osqtfiz" },
+		{ 't', "The trace export", "osqHfiz" },
+		{ 'f', "The filters", "osqHtz" },
+		{ 'i', "The fixed-point storage", "osqHtz" },
+		{ 'z', "The zero-copy buffers", "osqHtfi" },
+	};
+	for (const ModeFlag& mode : mode_flags)
+	{
+		if (given_flags.find(mode.flag) == string::npos)
+			continue;
+
+		for (const ModeFlag& other : mode_flags)
+		{
+			if (other.flag != mode.flag && given_flags.find(other.flag) != string::npos && !strchr(mode.companions, other.flag))
+			{
+				cout << mode.name << " (-" << mode.flag << ") cannot be combined with -" << other.flag << endl;
+				getchar();
+				return 1;
+			}
+		}
+	}
+
+	// The integer kernels only include the bitonic sort
+	if (fixed_point && sort_kernel != "bitonic")
+	{
+		cout << "The fixed-point storage is only available with the bitonic sort" << endl;
+		getchar();
+		return 1;
+	}
+
+	// The quantile sketch is built over a stream, in chunks of a default size unless one is given
+	if (sketch_error > 0.0 && !chunk_rows)
+		chunk_rows = SKETCH_CHUNK_ROWS;
+
+	// Timeline of every command and host phase, written to the trace file at the end of the run
+	Trace trace;
+	trace.enabled = !trace_file.empty();
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	//////////////////////////////////////////// BENCHMARK /////////////////////////////////////////////
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	// Time every stage over synthetic data sets of increasing size, instead of analysing the text file
+	if (benchmark)
+	{
+		try
+		{
+			cl::Context context = GetContext(platform_id, device_id);
+			cout << "Device Selected: " << GetPlatformName(platform_id) << ", " << GetDeviceName(platform_id, device_id) << endl;
+
+			// Same workgroup sizes as the main pipeline, so the stages are timed as the pipeline runs them
+			TuningProfile tuning;
+			benchmark_config.tuned = LoadTuningProfile(TUNING_PROFILE_FILE, context.getInfo<CL_CONTEXT_DEVICES>()[0], tuning);
+			string tuning_options = benchmark_config.tuned ? TuningBuildOptions(tuning) : "";
+			if (benchmark_config.tuned)
+			{
+				benchmark_config.stats_local = tuning.stats_local;
+				benchmark_config.stats_items = tuning.stats_items;
+				benchmark_config.histogram_local = tuning.histogram_local;
+				benchmark_config.histogram_items = tuning.histogram_items;
+				benchmark_config.sort_local = tuning.sort_local;
+				cout << "Workgroup sizes (tuned for this device): " << tuning_options << endl;
+			}
+
+			bool program_from_cache = false;
+			cl::Program program = BuildProgram(context, "my_kernels.cl", tuning_options, program_from_cache);
+
+			if (!RunBenchmark(context, program, benchmark_config))
+				cout << "The benchmark could not write its data or results files" << endl;
+		}
+		catch (const cl::Error& err) {
+			std::cerr << "ERROR: " << err.what() << ", " << getErrorString(err.err()) << std::endl;
+		}
+
+		getchar();
+		return 0;
+	}
+
+	const string file_name = "temp_lincolnshire.txt";
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	////////////////////////////////////////// INCREMENTAL UPDATE //////////////////////////////////////
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	// The file is only ever appended to: merge the rows added since the last run into the persisted state,
+	// instead of processing the whole history again
+	if (incremental)
+	{
+		try
+		{
+			cl::Context context = GetContext(platform_id, device_id);
+			cout << "Device Selected: " << GetPlatformName(platform_id) << ", " << GetDeviceName(platform_id, device_id) << endl;
+
+			auto build_start = chrono::high_resolution_clock::now();
+			bool program_from_cache = false;
+			cl::Program program = BuildProgram(context, "my_kernels.cl", "", program_from_cache);
+			auto build_end = chrono::high_resolution_clock::now();
+			unsigned long long build_ns = chrono::duration_cast<chrono::nanoseconds>(build_end - build_start).count();
+
+			IncrementalState state;
+			bool had_state = LoadIncrementalState(file_name, state);
+
+			IncrementalResult update;
+			if (!UpdateIncrementalState(context, program, file_name, state, update))
+			{
+				cout << "Cannot load text file..." << endl;
+				getchar();
+				return 1;
+			}
+
+			if (!SaveIncrementalState(file_name, state))
+				cout << "Could not write the state file (" << GetStateFileName(file_name) << ")" << endl;
+
+			if (state.stats.count == 0)
+			{
+				cout << "The file holds no records" << endl;
+				getchar();
+				return 1;
+			}
+
+			vector<uint64_t> state_cumulative = HistogramPrefixSum(state.histogram);
+			vector<size_t> state_ranks = OrderStatisticRanks((size_t)state_cumulative.back());
+
+			cout << endl;
+			cout << "---------------------------------- Performance Results ---------------------------------" << endl;
+			if (!had_state)
+				cout << "Incremental update (no previous state, every row processed): " << endl;
+			else if (update.reset)
+				cout << "Incremental update (file was rewritten, every row processed again): " << endl;
+			else
+				cout << "Incremental update (appended rows only): " << endl;
+			cout << "	Rows in the previous state: " << update.rows_before << endl;
+			cout << "	Rows appended: " << update.new_rows << endl;
+			cout << "	Bytes parsed: " << update.bytes_parsed << endl;
+			cout << "	Parse time: " << update.parse_ns << " [ns]" << endl;
+			cout << "	Kernel execution time: " << update.kernel_ns << " [ns]" << endl;
+			cout << "	Memory transfer: " << update.transfer_ns << " [ns]" << endl;
+			cout << "	Update wall time: " << update.wall_ns << " [ns]" << endl;
+			cout << (program_from_cache ? "Program load (cached binary): " : "Program build (from source): ") << build_ns << " [ns]" << endl;
+			cout << "----------------------- Statistical Analysis Calculation Results -----------------------" << endl;
+
+			cout << "Mean: " << TotalStatsMean(state.stats) << endl;
+			cout << "Standard Deviation: " << sqrt(TotalStatsVariance(state.stats)) << endl;
+			cout << "Min: " << state.stats.min << endl;
+			cout << "Max: " << state.stats.max << endl;
+			cout << "Median: " << HistogramRankValue(state_cumulative, state_ranks[2]) << endl;
+			cout << "First Quartile: " << HistogramRankValue(state_cumulative, state_ranks[1]) << endl;
+			cout << "Third Quartile: " << HistogramRankValue(state_cumulative, state_ranks[3]) << endl;
+			for (double percentile : percentiles)
+				cout << "Percentile " << percentile << ": " << HistogramPercentile(state_cumulative, percentile) << endl;
+
+			cout << endl;
+			cout << "Please enter any key to exit... ";
+		}
+		catch (const cl::Error& err) {
+			std::cerr << "ERROR: " << err.what() << ", " << getErrorString(err.err()) << std::endl;
+		}
+
+		getchar();
+		return 0;
+	}
+
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+	/////////////////////////////////////////////// BATCH //////////////////////////////////////////////
+	////////////////////////////////////////////////////////////////////////////////////////////////////
+
+	// Statistics of many files through one engine (one context, program and queue): every file is submitted as soon as
+	// it is loaded, so the device works on the previous files while the next one is parsed
+	if (!batch_files.empty())
+	{
+		try
+		{
+			cl::Context context = GetContext(platform_id, device_id);
+			cout << "Device Selected: " << GetPlatformName(platform_id) << ", " << GetDeviceName(platform_id, device_id) << endl;
+
+			auto build_start = chrono::high_resolution_clock::now();
+			bool program_from_cache = false;
+			cl::Program program = BuildProgram(context, "my_kernels.cl", "", program_from_cache);
+			auto build_end = chrono::high_resolution_clock::now();
+			unsigned long long build_ns = chrono::duration_cast<chrono::nanoseconds>(build_end - build_start).count();
+
+			StatsEngine engine(context, program);
+
+			auto batch_start = chrono::high_resolution_clock::now();
+			vector<future<EngineResult>> futures = engine.SubmitFiles(batch_files);
+
+			vector<EngineResult> results;
+			for (size_t f = 0; f < futures.size(); f++)
+			{
+				try
+				{
+					results.push_back(futures[f].get());
+				}
+				catch (const exception& err)
+				{
+					cout << batch_files[f] << ": " << err.what() << endl;
+				}
+			}
+			auto batch_end = chrono::high_resolution_clock::now();
+			unsigned long long batch_ns = chrono::duration_cast<chrono::nanoseconds>(batch_end - batch_start).count();
+
+			// Device time of every command, against the time from the first command to the last one
+			unsigned long long busy_ns = 0;
+			cl_ulong span_start = 0, span_end = 0;
+			for (const EngineResult& result : results)
+			{
+				if (!result.rows)
+					continue;
+				busy_ns += result.kernel_ns + result.transfer_ns;
+				span_start = (span_end == 0) ? result.device_start : min(span_start, result.device_start);
+				span_end = max(span_end, result.device_end);
+			}
+
+			cout << endl;
+			cout << "---------------------------------- Performance Results ---------------------------------" << endl;
+			cout << (program_from_cache ? "Program load (cached binary): " : "Program build (from source): ") << build_ns << " [ns]" << endl;
+			cout << "Batch of " << batch_files.size() << " files (one engine, " << (engine.OutOfOrder() ? "out-of-order" : "in-order") << " queue): " << endl;
+			cout << "\tWall time (load and statistics of every file): " << batch_ns << " [ns]" << endl;
+			cout << "\tDevice command time: " << busy_ns << " [ns]" << endl;
+			cout << "\tDevice time span: " << span_end - span_start << " [ns]" << endl;
+			cout << "----------------------- Statistical Analysis Calculation Results -----------------------" << endl;
+
+			cout << left << setw(32) << "File" << right << setw(10) << "Rows" << setw(10) << "Mean" << setw(10) << "Std Dev" << setw(10) << "Min"
+				<< setw(10) << "Max" << setw(10) << "Q1" << setw(10) << "Median" << setw(10) << "Q3" << setw(14) << "Latency [us]" << endl;
+			cout << fixed << setprecision(2);
+			for (const EngineResult& result : results)
+			{
+				cout << left << setw(32) << result.name << right << setw(10) << result.rows << setw(10) << result.stats.mean
+					<< setw(10) << sqrt(StatsVariance(result.stats)) << setw(10) << result.stats.min << setw(10) << result.stats.max
+					<< setw(10) << result.first_quartile << setw(10) << result.median << setw(10) << result.third_quartile
+					<< setw(14) << result.latency_ns / 1000 << endl;
+			}
+
+			cout << endl;
+			cout << "Please enter any key to exit... ";
+		}
+		catch (const cl::Error& err) {
+			std::cerr << "ERROR: " << err.what() << ", " << getErrorString(err.err()) << std::endl;
+		}
+
+		getchar();
+		return 0;
+	}
 
 	////////////////////////////////////////////////////////////////////////////////////////////////////
 	///////////////////////////////////// READ DATA FROM TEXT FILE /////////////////////////////////////
 	////////////////////////////////////////////////////////////////////////////////////////////////////
 
-	ifstream weather_data;
-	weather_data.open("temp_lincolnshire.txt");
-	string stationName, line;
-	int year, month, day, time;
-	float airTemp;
+	// Column-oriented storage for every row of the text file
+	WeatherData weather;
 
-	// Initialise vectors which will be used for storing each respective column of data from the text file
-	vector<string> stationNameVector = {};
-	vector<int> yearVector = {};
-	vector<int> monthVector = {};
-	vector<int> dayVector = {};
-	vector<int> timeVector = {};
-	vector<float> A = {};
+	// Memory-map the binary columnar cache of the file if there is an up-to-date one
+	auto load_start = chrono::high_resolution_clock::now();
+	bool from_cache = LoadWeatherCache(file_name, weather);
+	bool loaded = from_cache;
+
+	// The streaming mode parses the text file one chunk at a time instead (see ChunkSource)
+	if (!from_cache && chunk_rows)
+	{
+		uint64_t source_size;
+		int64_t source_mtime;
+		loaded = GetFileStamp(file_name, source_size, source_mtime);
+	}
+	else if (!from_cache)
+	{
+		cout << "Loading data from the text file..." << endl;
+
+		// Memory-map the file and parse it in newline-aligned chunks, one thread per chunk
+		loaded = LoadWeatherData(file_name, weather);
+	}
+	auto load_end = chrono::high_resolution_clock::now();
+	TracePhase(trace, from_cache ? "Load (binary cache)" : "Load (parse text file)", load_start, load_end);
 
 	// Check if the file exists, if it doesn't, terminate the program
-	if (weather_data.fail())
+	if (!loaded)
 	{
 		cout << "Cannot load text file..." << endl;
 		getchar();
 		return 1;
 	}
 
-	cout << "Loading data from the text file..." << endl;
+	// Store loading time and throughput of the loader
+	unsigned long long load_ns = chrono::duration_cast<chrono::nanoseconds>(load_end - load_start).count();
+	double load_rows_per_s = load_ns ? weather.rows / (load_ns * 1e-9) : 0.0;
 
-	// If the file exists, load the data into each of the respective vectors
-	while (!weather_data.eof())
+	// Write the cache next to the text file, so that the next run can skip parsing
+	if (!from_cache && !chunk_rows && !SaveWeatherCache(file_name, weather))
 	{
-		// Temporarily store the data into different variables
-		weather_data >> stationName >> year >> month >> day >> time >> airTemp;
-
-		// Add the data contained in each variable to each vector
-		stationNameVector.push_back(stationName);
-		yearVector.push_back(year);
-		monthVector.push_back(month);
-		dayVector.push_back(day);
-		timeVector.push_back(time);
-		A.push_back(airTemp);
+		cout << "Could not write the binary cache file (" << GetCacheFileName(file_name) << ")" << endl;
 	}
 
-	cout << "Data was successfully loaded from the text file!" << endl;
+	// Temperature column, used as the input vector of the kernels
+	size_t rows = weather.rows;
+	const float* A = weather.temperature;
+
+	if (from_cache)
+		cout << "Data was successfully loaded from the binary cache!" << endl;
+	else if (chunk_rows)
+		cout << "Data will be streamed from the text file!" << endl;
+	else
+		cout << "Data was successfully loaded from the text file!" << endl;
+
+	// Rows the statistics are computed over (evaluated on the device, see Predicate Pushdown)
+	RowFilter filter;
+	string filter_error;
+	if (!ParseFilter(weather, filter_text, filter, filter_error))
+	{
+		cout << "Invalid filter: " << filter_error << endl;
+		getchar();
+		return 1;
+	}
+	bool filtered = !IsEmptyFilter(filter);
 
 	/////////////////////////////////////////////////////////////////////////////////////////////////////////
-	////////////////////////////////// User Interface for Device Selection //////////////////////////////////
+	///////////////////////////////////////////// Host Backend //////////////////////////////////////////////
 	/////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-	for (int i = 1; i < argc; i++)	
+	// Same statistics on the host, without OpenCL (a baseline for the device path, and a fallback without a platform)
+	if (host_backend)
 	{
-		if ((strcmp(argv[i], "-p") == 0) && (i < (argc - 1))) { platform_id = atoi(argv[++i]); }
-		else if ((strcmp(argv[i], "-d") == 0) && (i < (argc - 1))) { device_id = atoi(argv[++i]); }
-		else if (strcmp(argv[i], "-l") == 0) { cout << ListPlatformsDevices() << endl; }
-		else if (strcmp(argv[i], "-h") == 0) { print_help(); }
+		// The order statistics need at least one row per quartile
+		if (rows < 4)
+		{
+			cout << "Only " << rows << " rows were loaded (at least 4 are needed)" << endl;
+			getchar();
+			return 1;
+		}
+
+		HostThreadPool pool;
+
+		auto host_stats_start = chrono::high_resolution_clock::now();
+		Stats host_stats = HostStatistics(pool, A, rows);
+		auto host_stats_end = chrono::high_resolution_clock::now();
+		vector<float> host_sorted = HostSort(pool, A, rows);
+		auto host_sort_end = chrono::high_resolution_clock::now();
+
+		unsigned long host_stats_ns = chrono::duration_cast<chrono::nanoseconds>(host_stats_end - host_stats_start).count();
+		unsigned long host_sort_ns = chrono::duration_cast<chrono::nanoseconds>(host_sort_end - host_stats_end).count();
+
+		cout << endl;
+		cout << "---------------------------------- Performance Results ---------------------------------" << endl;
+		cout << (from_cache ? "Data loading (binary cache): " : "Data loading (memory-mapped parser): ") << endl;
+		cout << "\tRows loaded: " << weather.rows << endl;
+		cout << "\tLoad time: " << load_ns << " [ns]" << endl;
+		cout << "\tThroughput: " << (unsigned long long)load_rows_per_s << " [rows/s]" << endl;
+		cout << endl;
+		cout << "Fused statistics on the host (count, sum, M2, min, max; " << HOST_SIMD_NAME << ", " << pool.Size() << " threads): " << endl;
+		cout << "\tKernel execution time: " << host_stats_ns << " [ns]" << endl;
+		cout << "\tMemory transfer: " << 0 << " [ns]" << endl;
+		cout << "\tOperation time: " << host_stats_ns << " [ns]" << endl;
+
+		cout << endl;
+		cout << "Parallel sort on the host (sorted runs, merged pairwise; " << pool.Size() << " threads): " << endl;
+		cout << "\tKernel execution time: " << host_sort_ns << " [ns]" << endl;
+		cout << "\tMemory transfer: " << 0 << " [ns]" << endl;
+		cout << "\tOperation time: " << host_sort_ns << " [ns]" << endl;
+
+		cout << endl;
+		cout << "Total program execution time: " << host_stats_ns + host_sort_ns << " [ns]" << endl;
+		cout << "----------------------- Statistical Analysis Calculation Results -----------------------" << endl;
+
+		vector<size_t> host_ranks = OrderStatisticRanks(rows);
+
+		cout << "Mean: " << host_stats.mean << endl;
+		cout << "Standard Deviation: " << sqrt(StatsVariance(host_stats)) << endl;
+		cout << "Min: " << host_stats.min << endl;
+		cout << "Max: " << host_stats.max << endl;
+		cout << "Median: " << host_sorted[host_ranks[2]] << endl;
+		cout << "First Quartile: " << host_sorted[host_ranks[1]] << endl;
+		cout << "Third Quartile: " << host_sorted[host_ranks[3]] << endl;
+
+		cout << endl;
+		cout << "Please enter any key to exit... ";
+		getchar();
+		return 0;
 	}
 
 	try {
+		/////////////////////////////////////////////////////////////////////////////////////////////////////////
+		///////////////////////////////////////////// Multi-Device //////////////////////////////////////////////
+		/////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+		// Partition the data across every device (and NUMA sub-device) of the platform, then merge on the host
+		if (multi_device)
+		{
+			vector<DeviceWorker> workers = GetDeviceWorkers(platform_id);
+			if (workers.empty() || rows < 4)
+			{
+				cout << "Nothing to run on this platform" << endl;
+				getchar();
+				return 1;
+			}
+
+			// Weight the partitions by a short run of the real work on each device
+			auto calibration_start = chrono::high_resolution_clock::now();
+			CalibrateDeviceWorkers(workers, A, rows, (size_t)1 << 16);
+			auto calibration_end = chrono::high_resolution_clock::now();
+			unsigned long long calibration_ns = chrono::duration_cast<chrono::nanoseconds>(calibration_end - calibration_start).count();
+
+			// Every device works on its partition at the same time (nothing below blocks until the wait)
+			auto multi_start = chrono::high_resolution_clock::now();
+			for (DeviceWorker& worker : workers)
+				EnqueuePartition(worker, A, worker.first, worker.rows);
+			for (DeviceWorker& worker : workers)
+				WaitPartition(worker);
+			auto multi_end = chrono::high_resolution_clock::now();
+
+			// Merge the moments and min/max of every partition, and select the order statistics across the sorted runs
+			Stats merged_stats = EmptyStats();
+			for (DeviceWorker& worker : workers)
+				merged_stats = MergeStats(merged_stats, worker.stats);
+			vector<size_t> multi_ranks = OrderStatisticRanks(rows);
+			vector<float> multi_order = SelectRanksFromRuns(workers, multi_ranks);
+			auto merge_end = chrono::high_resolution_clock::now();
+
+			unsigned long long multi_ns = chrono::duration_cast<chrono::nanoseconds>(multi_end - multi_start).count();
+			unsigned long long merge_ns = chrono::duration_cast<chrono::nanoseconds>(merge_end - multi_end).count();
+
+			cout << endl;
+			cout << "---------------------------------- Performance Results ---------------------------------" << endl;
+			cout << (from_cache ? "Data loading (binary cache): " : "Data loading (memory-mapped parser): ") << endl;
+			cout << "\tRows loaded: " << weather.rows << endl;
+			cout << "\tLoad time: " << load_ns << " [ns]" << endl;
+			cout << "\tThroughput: " << (unsigned long long)load_rows_per_s << " [rows/s]" << endl;
+			cout << endl;
+			cout << "Multi-device (fused statistics and bitonic sort per partition, merged on the host): " << endl;
+			cout << "\tCalibration (program builds and sample runs): " << calibration_ns << " [ns]" << endl;
+			for (DeviceWorker& worker : workers)
+			{
+				unsigned long long worker_kernel_ns = 0, worker_transfer_ns = 0;
+				for (auto& event : worker.kernel_events)
+					worker_kernel_ns += event.getProfilingInfo<CL_PROFILING_COMMAND_END>() - event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+				for (auto& event : worker.transfer_events)
+					worker_transfer_ns += event.getProfilingInfo<CL_PROFILING_COMMAND_END>() - event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+
+				vector<cl::Event> worker_events = worker.kernel_events;
+				worker_events.insert(worker_events.end(), worker.transfer_events.begin(), worker.transfer_events.end());
+
+				cout << "\t" << worker.name << ":" << endl;
+				cout << "\t\tCalibration throughput: " << (unsigned long long)worker.rows_per_s << " [rows/s]" << endl;
+				cout << "\t\tRows: " << worker.rows << endl;
+				cout << "\t\tKernel execution time: " << worker_kernel_ns << " [ns]" << endl;
+				cout << "\t\tMemory transfer: " << worker_transfer_ns << " [ns]" << endl;
+				cout << "\t\tDevice time span: " << (worker.rows ? GetProfilingSpan(worker_events) : 0) << " [ns]" << endl;
+			}
+			cout << "\tWall time (all devices): " << multi_ns << " [ns]" << endl;
+			cout << "\tHost merge time: " << merge_ns << " [ns]" << endl;
+			cout << "----------------------- Statistical Analysis Calculation Results -----------------------" << endl;
+
+			cout << "Mean: " << merged_stats.mean << endl;
+			cout << "Standard Deviation: " << sqrt(StatsVariance(merged_stats)) << endl;
+			cout << "Min: " << merged_stats.min << endl;
+			cout << "Max: " << merged_stats.max << endl;
+			cout << "Median: " << multi_order[2] << endl;
+			cout << "First Quartile: " << multi_order[1] << endl;
+			cout << "Third Quartile: " << multi_order[3] << endl;
+
+			cout << endl;
+			cout << "Please enter any key to exit... ";
+			getchar();
+			return 0;
+		}
+
 		cl::Context context = GetContext(platform_id, device_id);
 
 		// Display the selected device
 		cout << "Device Selected: " << GetPlatformName(platform_id) << ", " << GetDeviceName(platform_id, device_id) << endl; 
 
 		// Queue variable which will be used to push commands to the device
-		cl::CommandQueue queue(context, CL_QUEUE_PROFILING_ENABLE);
+		// Every command is chained through events, so the stages can also run on an out-of-order queue
+		cl::CommandQueue queue;
+		try
+		{
+			queue = cl::CommandQueue(context, CL_QUEUE_PROFILING_ENABLE | (out_of_order ? CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE : 0));
+		}
+		catch (const cl::Error&)
+		{
+			if (!out_of_order)
+				throw;
+
+			cout << "Out-of-order queues are not supported by this device, using an in-order queue" << endl;
+			queue = cl::CommandQueue(context, CL_QUEUE_PROFILING_ENABLE);
+			out_of_order = false;
+		}
+
+
+		// Workgroup sizes of the single device pipeline, from the profile of this device if it has been autotuned (see -T).
+		// They are baked into the program, so the other modes (which size their own launches) keep the plain build.
+		TuningProfile tuning;
+		bool pipeline_run = !autotune && !query_server && !chunk_rows && group_by.empty() && rolling_windows.empty();
+		bool tuned = pipeline_run && LoadTuningProfile(TUNING_PROFILE_FILE, context.getInfo<CL_CONTEXT_DEVICES>()[0], tuning);
+		string tuning_options = tuned ? TuningBuildOptions(tuning) : "";
+
+		// Load the device code, from the cached binary of a previous run if there is a matching one
+		auto build_start = chrono::high_resolution_clock::now();
+		bool program_from_cache = false;
+		cl::Program program = BuildProgram(context, "my_kernels.cl", tuning_options, program_from_cache);
+		auto build_end = chrono::high_resolution_clock::now();
+		TracePhase(trace, program_from_cache ? "Program load (cached binary)" : "Program build (from source)", build_start, build_end);
+
+		// Store build (or binary load) time
+		unsigned long long build_ns = chrono::duration_cast<chrono::nanoseconds>(build_end - build_start).count();
+
+		/////////////////////////////////////////////////////////////////////////////////////////////////////////
+		/////////////////////////////////////////////// Autotune ////////////////////////////////////////////////
+		/////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+		// Time every candidate workgroup configuration of the pipeline kernels on this device, and keep the fastest
+		// in the tuning profile, which every later run on this device picks up
+		if (autotune)
+		{
+			if (rows < 4)
+			{
+				cout << "The file holds too few records to tune on" << endl;
+				getchar();
+				return 1;
+			}
+
+			cl::Device device = context.getInfo<CL_CONTEXT_DEVICES>()[0];
+			cout << "Tuning " << TuningDeviceName(device) << " over " << rows << " rows (" << benchmark_config.warmup << " warm-up runs, "
+				<< benchmark_config.repetitions << " repetitions)..." << endl;
+
+			auto tune_start = chrono::high_resolution_clock::now();
+			vector<TuningSample> tuning_samples;
+			TuningProfile best = AutotuneDevice(context, program, A, rows, benchmark_config.warmup, benchmark_config.repetitions, tuning_samples);
+			auto tune_end = chrono::high_resolution_clock::now();
+			unsigned long long tune_ns = chrono::duration_cast<chrono::nanoseconds>(tune_end - tune_start).count();
+
+			cout << endl;
+			cout << left << setw(20) << "Kernel" << right << setw(12) << "Local size" << setw(20) << "Elements per item" << setw(16) << "Median [ns]" << endl;
+			for (const TuningSample& sample : tuning_samples)
+			{
+				cout << left << setw(20) << sample.kernel << right << setw(12) << sample.local_size << setw(20) << (sample.items ? to_string(sample.items) : "-")
+					<< setw(16) << (unsigned long long)sample.median_ns << endl;
+			}
+
+			cout << endl;
+			cout << "Tuning time: " << tune_ns << " [ns]" << endl;
+			cout << "Fused statistics: local size " << best.stats_local << ", " << best.stats_items << " elements per work-item" << endl;
+			cout << "Histogram: local size " << best.histogram_local << ", " << best.histogram_items << " elements per work-item" << endl;
+			cout << "Bitonic sort: local size " << best.sort_local << endl;
+			if (SaveTuningProfile(TUNING_PROFILE_FILE, device, best))
+				cout << "Profile saved to " << TUNING_PROFILE_FILE << " (build options " << TuningBuildOptions(best) << ")" << endl;
+			else
+				cout << "Could not write the tuning profile (" << TUNING_PROFILE_FILE << ")" << endl;
+
+			cout << endl;
+			cout << "Please enter any key to exit... ";
+			getchar();
+			return 0;
+		}
+
+		/////////////////////////////////////////////////////////////////////////////////////////////////////////
+		///////////////////////////////////////////// Query Server //////////////////////////////////////////////
+		/////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+		// Keep the context, program and columns resident and answer requests from stdin, one per line,
+		// so each query only pays for its own kernels instead of a whole process start
+		if (query_server)
+		{
+			if (rows == 0)
+			{
+				cout << "The file holds no records" << endl;
+				return 1;
+			}
+
+			auto server_start = chrono::high_resolution_clock::now();
+			QueryServer server;
+			StartQueryServer(server, context, program, weather);
+			auto server_end = chrono::high_resolution_clock::now();
+			unsigned long long server_ns = chrono::duration_cast<chrono::nanoseconds>(server_end - server_start).count();
+
+			cout << (from_cache ? "Data loading (binary cache): " : "Data loading (memory-mapped parser): ") << load_ns << " [ns]" << endl;
+			cout << (program_from_cache ? "Program load (cached binary): " : "Program build (from source): ") << build_ns << " [ns]" << endl;
+			cout << "Upload and unfiltered statistics: " << server_ns << " [ns]" << endl;
+			cout << "Ready (type help for the requests)" << endl;
+
+			RunQueryServer(server, cin, cout);
+
+			cout << "Queries answered: " << server.queries << endl;
+			cout << "Mean query latency: " << (server.queries ? server.total_ns / server.queries : 0) << " [ns]" << endl;
+			return 0;
+		}
+
+		/////////////////////////////////////////////////////////////////////////////////////////////////////////
+		///////////////////////////////////////// Out-of-Core Streaming /////////////////////////////////////////
+		/////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+		// Process the data in fixed-size chunks through rotating device buffers, instead of one buffer holding everything
+		if (chunk_rows)
+		{
+			ChunkSource source;
+			if (from_cache)
+			{
+				source.column = weather.temperature;
+				source.rows = weather.rows;
+			}
+			else if (!OpenTemperatureReader(source.reader, file_name))
+			{
+				cout << "Cannot load text file..." << endl;
+				getchar();
+				return 1;
+			}
+
+			// Approximate quantiles from a mergeable sketch (one pass), instead of the exact radix select (four passes)
+			bool sketched = sketch_error > 0.0;
+			QuantileSketch sketch = EmptySketch(sketched ? sketch_error : 1.0);
+
+			StreamResult streamed;
+			StreamStatistics(context, program, source, chunk_rows, streamed, sketched ? &sketch : nullptr);
+
+			if (streamed.rows < 4)
+			{
+				cout << "Only " << streamed.rows << " rows were streamed (at least 4 are needed)" << endl;
+				getchar();
+				return 1;
+			}
+
+			// The sketches of earlier runs are merged in with the statistics of their rows, so that every result covers
+			// the same rows, and the merged sketch is saved for the next run
+			TotalStats stats = streamed.stats;
+			bool sketch_merged = false;
+			if (sketched && !sketch_file.empty())
+			{
+				QuantileSketch previous;
+				TotalStats previous_stats;
+				sketch_merged = LoadSketch(sketch_file, previous, previous_stats);
+				if (sketch_merged)
+				{
+					MergeSketch(sketch, previous);
+					stats = MergeTotalStats(stats, previous_stats);
+				}
+				if (!SaveSketch(sketch_file, sketch, stats))
+					cout << "Could not write the sketch file (" << sketch_file << ")" << endl;
+			}
+
+			unsigned long long streamed_op = streamed.upload_ns + streamed.kernel_ns + streamed.read_ns;
+			double streamed_rows_per_s = streamed.wall_ns ? streamed.rows * streamed.passes / (streamed.wall_ns * 1e-9) : 0.0;
+
+			cout << endl;
+			cout << "---------------------------------- Performance Results ---------------------------------" << endl;
+			cout << (from_cache ? "Streaming (binary cache, " : "Streaming (text file parsed chunk by chunk, ") << STREAM_SLOTS << " rotating device buffers): " << endl;
+			cout << "\tRows streamed: " << streamed.rows << endl;
+			cout << "\tChunks per pass: " << streamed.chunks << " (" << min(chunk_rows, streamed.rows) << " rows each)" << endl;
+			cout << "\tPasses over the data: " << streamed.passes << endl;
+			cout << "\tDevice memory footprint: " << streamed.device_bytes << " [bytes]" << endl;
+			cout << "\tKernel launches: " << streamed.kernel_launches << endl;
+			cout << "\tKernel execution time: " << streamed.kernel_ns << " [ns]" << endl;
+			cout << "\tMemory transfer: " << streamed.upload_ns + streamed.read_ns << " [ns]" << endl;
+			cout << "\tOperation time: " << streamed_op << " [ns]" << endl;
+			cout << "\tWall time: " << streamed.wall_ns << " [ns]" << endl;
+			cout << "\tThroughput: " << (unsigned long long)streamed_rows_per_s << " [rows/s]" << endl;
+			if (sketched)
+			{
+				cout << "Quantile sketch (blocks sorted and sampled on the device, merged on the host): " << endl;
+				cout << "\tSamples read back: " << streamed.sketch_samples << endl;
+				cout << "\tItems held: " << SketchItems(sketch) << " (" << SketchItems(sketch) * sizeof(float) << " [bytes], independent of the rows)" << endl;
+				cout << "\tRows summarised: " << sketch.count << (sketch_merged ? " (merged with " + sketch_file + ")" : "") << endl;
+			}
+			cout << (program_from_cache ? "Program load (cached binary): " : "Program build (from source): ") << build_ns << " [ns]" << endl;
+			cout << "----------------------- Statistical Analysis Calculation Results -----------------------" << endl;
+
+			if (sketch_merged)
+				cout << "Rows: " << stats.count << " (this run and the runs merged from " << sketch_file << ")" << endl;
+			cout << "Mean: " << TotalStatsMean(stats) << endl;
+			cout << "Standard Deviation: " << sqrt(TotalStatsVariance(stats)) << endl;
+			cout << "Min: " << stats.min << endl;
+			cout << "Max: " << stats.max << endl;
+			if (sketched)
+			{
+				// Every rank is within the bound with 99% probability (see SketchRankError)
+				vector<size_t> ranks = OrderStatisticRanks((size_t)sketch.count);
+				double rank_error = SketchRankError(sketch);
+				cout << "Median: " << SketchRankValue(sketch, ranks[2]) << " (approximate)" << endl;
+				cout << "First Quartile: " << SketchRankValue(sketch, ranks[1]) << " (approximate)" << endl;
+				cout << "Third Quartile: " << SketchRankValue(sketch, ranks[3]) << " (approximate)" << endl;
+				cout << "Rank error bound: +-" << (uint64_t)ceil(rank_error) << " rows (" << 100.0 * rank_error / sketch.count << "% of the rows, with " << 100.0 * (1.0 - SKETCH_FAILURE) << "% confidence; requested " << 100.0 * sketch_error << "%)" << endl;
+			}
+			else
+			{
+				cout << "Median: " << keyToFloat(streamed.order_keys[2]) << endl;
+				cout << "First Quartile: " << keyToFloat(streamed.order_keys[1]) << endl;
+				cout << "Third Quartile: " << keyToFloat(streamed.order_keys[3]) << endl;
+			}
+
+			cout << endl;
+			cout << "Please enter any key to exit... ";
+			getchar();
+			return 0;
+		}
 
+		/////////////////////////////////////////////////////////////////////////////////////////////////////////
+		///////////////////////////////////////// Group-by Statistics ///////////////////////////////////////////
+		/////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-		// Load and build the device code
-		cl::Program::Sources sources; 
+		// Statistics of every station, year or station x month, instead of the whole file
+		if (!group_by.empty())
+		{
+			GroupMode mode;
+			if (!ParseGroupMode(group_by, mode))
+			{
+				cout << "Unknown grouping: " << group_by << endl;
+				print_help();
+				getchar();
+				return 1;
+			}
+
+			// The group keys are sorted as 64-bit integers, by the same bitonic kernels built for that type
+			auto sort_build_start = chrono::high_resolution_clock::now();
+			bool sort_program_from_cache = false;
+			cl::Program sort_program = BuildProgram(context, "my_kernels.cl", "-D SORT_T=ulong", sort_program_from_cache);
+			auto sort_build_end = chrono::high_resolution_clock::now();
+			build_ns += chrono::duration_cast<chrono::nanoseconds>(sort_build_end - sort_build_start).count();
+			program_from_cache = program_from_cache && sort_program_from_cache;
+
+			GroupByResult grouped;
+			GroupByStatistics(context, program, sort_program, weather, mode, grouped);
+
+			cout << endl;
+			cout << "---------------------------------- Performance Results ---------------------------------" << endl;
+			cout << (from_cache ? "Data loading (binary cache): " : "Data loading (memory-mapped parser): ") << endl;
+			cout << "\tRows loaded: " << weather.rows << endl;
+			cout << "\tLoad time: " << load_ns << " [ns]" << endl;
+			cout << "\tThroughput: " << (unsigned long long)load_rows_per_s << " [rows/s]" << endl;
+			cout << (program_from_cache ? "Program load (cached binary): " : "Program build (from source): ") << build_ns << " [ns]" << endl;
+			cout << endl;
+			cout << "Group-by kernels (keys, bitonic sort of the keys, segment bounds, segment statistics): " << endl;
+			cout << "\tGroups: " << grouped.groups.size() << endl;
+			cout << "\tKernel launches: " << grouped.kernel_launches << endl;
+			cout << "\tKernel execution time: " << grouped.kernel_ns << " [ns]" << endl;
+			cout << "\tMemory transfer: " << grouped.transfer_ns << " [ns]" << endl;
+			cout << "\tOperation time: " << grouped.kernel_ns + grouped.transfer_ns << " [ns]" << endl;
+			cout << "\tWall time: " << grouped.wall_ns << " [ns]" << endl;
+			cout << "----------------------- Statistical Analysis Calculation Results -----------------------" << endl;
+
+			cout << left << setw(24) << "Group" << right << setw(10) << "Rows" << setw(10) << "Mean" << setw(10) << "Std Dev"
+				<< setw(10) << "Min" << setw(10) << "Max" << setw(10) << "Q1" << setw(10) << "Median" << setw(10) << "Q3" << endl;
+			cout << fixed << setprecision(2);
+			for (const GroupStats& group : grouped.groups)
+			{
+				cout << left << setw(24) << GroupLabel(weather, mode, group.group) << right << setw(10) << group.stats.count
+					<< setw(10) << group.stats.mean << setw(10) << sqrt(StatsVariance(group.stats))
+					<< setw(10) << group.stats.min << setw(10) << group.stats.max
+					<< setw(10) << group.first_quartile << setw(10) << group.median << setw(10) << group.third_quartile << endl;
+			}
+
+			cout << endl;
+			cout << "Please enter any key to exit... ";
+			getchar();
+			return 0;
+		}
 
-		AddSources(sources, "my_kernels.cl");
-		cl::Program program(context, sources);
+		/////////////////////////////////////////////////////////////////////////////////////////////////////////
+		/////////////////////////////////////////// Rolling Windows /////////////////////////////////////////////
+		/////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-		// Build and debug the kernel code currently residing on the device
-		try 
+		// Rolling mean and standard deviation of every station over windows of a few days, instead of the whole file
+		if (!rolling_windows.empty())
 		{
-			program.build();
+			// The readings are sorted as 64-bit keys and scanned as 64-bit integers, by the same kernels built for those types
+			auto rolling_build_start = chrono::high_resolution_clock::now();
+			bool rolling_program_from_cache = false;
+			cl::Program rolling_program = BuildProgram(context, "my_kernels.cl", "-D SORT_T=ulong -D SCAN_T=long", rolling_program_from_cache);
+			auto rolling_build_end = chrono::high_resolution_clock::now();
+			build_ns += chrono::duration_cast<chrono::nanoseconds>(rolling_build_end - rolling_build_start).count();
+			program_from_cache = program_from_cache && rolling_program_from_cache;
+
+			RollingResult rolling;
+			RollingStatistics(context, rolling_program, weather, rolling_windows, rolling);
+
+			string rolling_file = file_name + ".rolling";
+			bool rolling_written = WriteRollingFile(rolling_file, rolling);
+
+			cout << endl;
+			cout << "---------------------------------- Performance Results ---------------------------------" << endl;
+			cout << (from_cache ? "Data loading (binary cache): " : "Data loading (memory-mapped parser): ") << endl;
+			cout << "\tRows loaded: " << weather.rows << endl;
+			cout << "\tLoad time: " << load_ns << " [ns]" << endl;
+			cout << "\tThroughput: " << (unsigned long long)load_rows_per_s << " [rows/s]" << endl;
+			cout << (program_from_cache ? "Program load (cached binary): " : "Program build (from source): ") << build_ns << " [ns]" << endl;
+			cout << endl;
+			cout << "Rolling-window kernels (keys, bitonic sort, prefix sums, one window step per window): " << endl;
+			cout << "\tWindows: " << rolling_windows.size() << endl;
+			cout << "\tKernel launches: " << rolling.kernel_launches << endl;
+			cout << "\tKernel execution time: " << rolling.kernel_ns << " [ns]" << endl;
+			cout << "\tMemory transfer: " << rolling.transfer_ns << " [ns]" << endl;
+			cout << "\tOperation time: " << rolling.kernel_ns + rolling.transfer_ns << " [ns]" << endl;
+			cout << "\tWall time: " << rolling.wall_ns << " [ns]" << endl;
+			if (rolling_written)
+				cout << "\tSeries written to: " << rolling_file << endl;
+			else
+				cout << "Could not write the rolling series file (" << rolling_file << ")" << endl;
+			cout << "----------------------- Statistical Analysis Calculation Results -----------------------" << endl;
+
+			// Latest reading of every station, against each of its windows
+			cout << left << setw(24) << "Station" << right << setw(18) << "Latest reading" << setw(10) << "Temp";
+			for (int days : rolling_windows)
+				cout << setw(12) << ("Mean " + to_string(days) + "d") << setw(12) << ("Std " + to_string(days) + "d");
+			cout << endl;
+			cout << fixed << setprecision(2);
+			for (size_t i = 0; i < rolling.keys.size(); i++)
+			{
+				uint16_t station = RollingKeyStation(rolling.keys[i]);
+				if (i + 1 < rolling.keys.size() && RollingKeyStation(rolling.keys[i + 1]) == station)
+					continue;
+
+				uint32_t date_time = RollingKeyDateTime(rolling.keys[i]);
+				char latest[32];
+				snprintf(latest, sizeof(latest), "%04d-%02d-%02d %04d", UnpackYear(date_time), UnpackMonth(date_time), UnpackDay(date_time), UnpackTime(date_time));
+
+				cout << left << setw(24) << weather.stations[station] << right << setw(18) << latest << setw(10) << RollingKeyTemperature(rolling.keys[i]);
+				for (size_t w = 0; w < rolling_windows.size(); w++)
+					cout << setw(12) << rolling.mean[w][i] << setw(12) << rolling.stddev[w][i];
+				cout << endl;
+			}
+
+			cout << endl;
+			cout << "Please enter any key to exit... ";
+			getchar();
+			return 0;
 		}
-		catch (const cl::Error& err) 
+
+		/////////////////////////////////////////////////////////////////////////////////////////////////////////
+		//////////////////////////////////////// Fixed-Point Storage ////////////////////////////////////////////
+		/////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+		// Every reading has one decimal place, so the column can travel and be read as 16-bit tenths of a degree
+		// (half the bytes of the floats), with exact integer sums and a sort on 16-bit keys
+		PageVector<cl_short> fixed_A;
+		cl::Program fixed_sort_program;
+		unsigned long long encode_ns = 0;
+		if (fixed_point)
+		{
+			auto encode_start = chrono::high_resolution_clock::now();
+			fixed_point = EncodeTenths(A, rows, fixed_A);
+			auto encode_end = chrono::high_resolution_clock::now();
+			encode_ns = chrono::duration_cast<chrono::nanoseconds>(encode_end - encode_start).count();
+			TracePhase(trace, "Encode tenths", encode_start, encode_end);
+
+			if (!fixed_point)
+			{
+				cout << "Not every temperature is a whole number of tenths, using 32-bit floats" << endl;
+				fixed_A.clear();
+			}
+		}
+
+		if (fixed_point)
 		{
-			cout << "Build Status: " << program.getBuildInfo<CL_PROGRAM_BUILD_STATUS>(context.getInfo<CL_CONTEXT_DEVICES>()[0]) << endl;
-			cout << "Build Options:\t" << program.getBuildInfo<CL_PROGRAM_BUILD_OPTIONS>(context.getInfo<CL_CONTEXT_DEVICES>()[0]) << endl;
-			cout << "Build Log:\t " << program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(context.getInfo<CL_CONTEXT_DEVICES>()[0]) << endl;
-			throw err;
+			// The keys are sorted as 16-bit integers, by the same bitonic kernels built for that type
+			auto sort_build_start = chrono::high_resolution_clock::now();
+			bool sort_program_from_cache = false;
+			fixed_sort_program = BuildProgram(context, "my_kernels.cl", "-D SORT_T=short" + (tuned ? " " + tuning_options : ""), sort_program_from_cache);
+			auto sort_build_end = chrono::high_resolution_clock::now();
+			build_ns += chrono::duration_cast<chrono::nanoseconds>(sort_build_end - sort_build_start).count();
+			program_from_cache = program_from_cache && sort_program_from_cache;
+			TracePhase(trace, sort_program_from_cache ? "Program load (cached binary, int16 sort)" : "Program build (from source, int16 sort)", sort_build_start, sort_build_end);
 		}
 
 		/////////////////////////////////////////////////////////////////////////////////////////////////////////
 		//////////////////////////////////// Parallel Statistical Operations ////////////////////////////////////
 		/////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+		// Wall time of the whole chained pipeline, from the upload to the final result read
+		auto pipeline_start = chrono::high_resolution_clock::now();
+		TraceDeviceAnchor(trace, pipeline_start);
+
+		// Event variable for profiling the upload of the input vector
+		cl::Event upload_event;
+
+		// On a device which shares host memory, the buffers are created over the host columns instead of copied into
+		// (the loader keeps them page-aligned), and the sorted data is mapped instead of read back
+		if (zero_copy && !SharesHostMemory(context.getInfo<CL_CONTEXT_DEVICES>()[0]))
+		{
+			cout << "The device does not share host memory, using copies instead of zero-copy buffers" << endl;
+			zero_copy = false;
+		}
+
+		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+		/////////////////////////////////////////////////////// PREDICATE PUSHDOWN ///////////////////////////////////////////////////////////////////
+		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+		// Define the size of the workgroups in which the data will be sent to on the device (tuned for the device, see -T)
+		size_t local_size = tuned ? tuning.sort_local : 16;
+
+		// With a filter, every column is uploaded once and the temperatures of the matching rows are compacted into a
+		// dense buffer on the device (flags, exclusive scan, scatter), which every stage below then reads instead
+		size_t total_rows = rows;
+		Compaction compaction;
+		vector<cl::Event> filter_upload_events(2);
+		cl::Buffer buffer_stations, buffer_date_times, buffer_full;
+
+		if (filtered)
+		{
+			if (zero_copy)
+			{
+				buffer_stations = CreateZeroCopyBuffer(context, queue, weather.stationId, rows * sizeof(uint16_t), rows * sizeof(uint16_t), ColumnCapacity(weather.stationIdColumn, weather.stationId), filter_upload_events[0]);
+				buffer_date_times = CreateZeroCopyBuffer(context, queue, weather.dateTime, rows * sizeof(uint32_t), rows * sizeof(uint32_t), ColumnCapacity(weather.dateTimeColumn, weather.dateTime), filter_upload_events[1]);
+				buffer_full = CreateZeroCopyBuffer(context, queue, A, rows * sizeof(float), rows * sizeof(float), ColumnCapacity(weather.airTemp, A), upload_event);
+			}
+			else
+			{
+				buffer_stations = cl::Buffer(context, CL_MEM_READ_ONLY, rows * sizeof(uint16_t));
+				buffer_date_times = cl::Buffer(context, CL_MEM_READ_ONLY, rows * sizeof(uint32_t));
+				buffer_full = cl::Buffer(context, CL_MEM_READ_ONLY, rows * sizeof(float));
+
+				queue.enqueueWriteBuffer(buffer_stations, CL_FALSE, 0, rows * sizeof(uint16_t), weather.stationId, NULL, &filter_upload_events[0]);
+				queue.enqueueWriteBuffer(buffer_date_times, CL_FALSE, 0, rows * sizeof(uint32_t), weather.dateTime, NULL, &filter_upload_events[1]);
+				queue.enqueueWriteBuffer(buffer_full, CL_FALSE, 0, rows * sizeof(float), A, NULL, &upload_event);
+			}
+			vector<cl::Event> columns_ready = filter_upload_events;
+			columns_ready.push_back(upload_event);
+			TraceCommand(trace, upload_event, "Upload input");
+			TraceCommand(trace, filter_upload_events[0], "Upload station column");
+			TraceCommand(trace, filter_upload_events[1], "Upload date/time column");
+
+			// The dense buffer has room for the padding of the stages below (at most one workgroup)
+			rows = CompactRows(context, queue, program, buffer_stations, buffer_date_times, buffer_full, total_rows, filter, total_rows + local_size, columns_ready, compaction);
+			TraceCommands(trace, compaction.kernel_events, "Predicate pushdown (flags, scan, compact)");
+			TraceCommands(trace, compaction.transfer_events, "Read match count");
+
+			if (rows < 4)
+			{
+				cout << "Only " << rows << " of " << total_rows << " rows match the filter (at least 4 are needed)" << endl;
+				getchar();
+				return 1;
+			}
+		}
+
 		// Initialise variables
-		vector<float> sorted_temp(A.size());
-		size_t vector_elements = sorted_temp.size();
+		size_t vector_elements = rows;
 		float mean = 0.f;
 		float _min = 0.f;
 		float _max = 0.f;
@@ -125,204 +1089,492 @@ int main(int argc, char **argv)
 		unsigned long mex1 = 0;
 		unsigned long mex2 = 0;
 
-		// Event variable for profiling kernel execution time
-		cl::Event reduce_add_exe_event;
-		cl::Event reduce_standard_deviation_exe_event;
-		cl::Event sort_exe_event;
-
-		// Event variable for profiling memory transfer start
-		cl::Event reduce_add_mem_event_1;
-		cl::Event reduce_add_mem_event_2;
+		// Ranks of the min, first quartile, median, third quartile and max within the sorted data
+		vector<size_t> ranks = OrderStatisticRanks(vector_elements);
+		vector<float> order_stats(ranks.size());
 
-		cl::Event reduce_standard_deviation_mem_event_1;
-		cl::Event reduce_standard_deviation_mem_event_2;
-
-		cl::Event sort_mem_event_1;
-		cl::Event sort_mem_event_2;
+		// Event variable for profiling kernel execution time
+		vector<cl::Event> reduce_statistics_exe_events;
+		vector<cl::Event> sort_exe_events;
 
-		// Second vector used for the output of the kernels
-		vector<float> B(A.size());
+		// Event variable for profiling memory transfers
+		cl::Event reduce_statistics_mem_event;
+		vector<cl::Event> sort_mem_events;
 
-		// Define the size of the workgroups in which the data will be sent to on the device
-		size_t local_size = 16;
+		// Second vector used for the output of the kernels (in tenths with the fixed-point storage)
+		vector<float> B;
+		vector<cl_short> B_fixed;
 
 		// Pad the vector with a neutral value, in this case a very high temperature value
-		float pad = 300000.f;
+		// (the fixed-point storage uses its reserved sentinel instead, see FIXED_PAD)
+		float pad = SORT_PAD;
+
+		// Bytes of every element of the input vector
+		size_t element_size = fixed_point ? sizeof(cl_short) : sizeof(float);
 
 		// Pad the vector and ensure that the vector size is divisible by the workgroup size
-		float padding_size = A.size() % local_size;
-		
-		// If the input vector is not currently divisible by the workgroup size:
-		// Insert additional neutral elements to the input vector
-		if (padding_size)
-		{
-			// Create an extra temporary vector which stores the required amount of neutral elements
-			std::vector<float> A_ext(local_size - padding_size, pad);
-			
-			// Append this extra temporary vector to the end of the input vector
-			A.insert(A.end(), A_ext.begin(), A_ext.end());
-		}
+		size_t padding_size = rows % local_size;
 
 		// Total elements within the input vector
-		size_t input_elements = A.size();
+		// If the input vector is not currently divisible by the workgroup size, the device buffer is
+		// extended with additional neutral elements (filled in on the device, so the host column is never copied)
+		size_t input_elements = padding_size ? rows + (local_size - padding_size) : rows;
 
 		// Total size of the input vector, in bytes
-		size_t input_size = A.size() * sizeof(float);
+		size_t input_size = input_elements * element_size;
 
-		// Total size of the output vector, in bytes
-		size_t output_size = B.size() * sizeof(float); 
+		// Size of the actual data within the input vector, in bytes
+		size_t data_size = rows * element_size;
 
-		// Calculate the total number of workgroups that will be used on the device
-		size_t nr_groups = input_elements / local_size;
+		// Total size of the output vector, in bytes (every padded element, since the selection sort writes the pad values too)
+		size_t output_size = input_size;
 
 		// Establish a buffer which will be used for the input vector, ensure read-only to avoid kernels overwriting the original input vector unnecessarily
-		cl::Buffer buffer_A(context, CL_MEM_READ_ONLY, input_size);
-
-		// Establish a buffer which will be used for the output vector, ensure write-only to avoid kernels unnecessarily interpreting it as the input vector
-		cl::Buffer buffer_B(context, CL_MEM_WRITE_ONLY, output_size);
+		// (with a filter, the input vector is the dense buffer of the matching rows, and with zero-copy buffers it is created along with the upload)
+		cl::Buffer buffer_A;
+		if (filtered)
+			buffer_A = compaction.output;
+		else if (!zero_copy)
+			buffer_A = cl::Buffer(context, CL_MEM_READ_ONLY, input_size);
 
 		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-		/////////////////////////////////////////////////////// PARALLEL ADDITION KERNEL /////////////////////////////////////////////////////////////
+		/////////////////////////////////////////////////////////// UPLOAD (ONCE) ////////////////////////////////////////////////////////////////////
 		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-		// Copy the input vector to the device memory
-		queue.enqueueWriteBuffer(buffer_A, CL_TRUE, 0, input_size, &A[0], NULL, &reduce_add_mem_event_1);
-
-		// Initialise output vector on the device memory (zero buffer)
-		queue.enqueueFillBuffer(buffer_B, 0, 0, output_size);//zero B buffer on device memory
-
-		// Kernel responsible for the parallel addition involved when calculating the average of the weather dataset
-		cl::Kernel kernel_1 = cl::Kernel(program, "reduce_add");
-		kernel_1.setArg(0, buffer_A);
-		kernel_1.setArg(1, buffer_B);
-		kernel_1.setArg(2, cl::Local(local_size * sizeof(float))); // local memory size
-		kernel_1.setArg(3, pad); // padding size
-
+		// Copy the input vector to the device memory once (non-blocking), every stage below reads it from buffer_A
+		vector<cl::Event> input_ready;
+		if (filtered)
+		{
+			input_ready = { compaction.kernel_events.back() };
+		}
+		else if (zero_copy)
+		{
+			if (fixed_point)
+				buffer_A = CreateZeroCopyBuffer(context, queue, fixed_A.data(), data_size, input_size, ColumnCapacity(fixed_A, fixed_A.data()), upload_event);
+			else
+				buffer_A = CreateZeroCopyBuffer(context, queue, A, data_size, input_size, ColumnCapacity(weather.airTemp, A), upload_event);
+			input_ready = { upload_event };
+			TraceCommand(trace, upload_event, "Upload input (zero-copy)");
+		}
+		else
+		{
+			queue.enqueueWriteBuffer(buffer_A, CL_FALSE, 0, data_size, fixed_point ? (const void*)fixed_A.data() : (const void*)A, NULL, &upload_event);
+			input_ready = { upload_event };
+			TraceCommand(trace, upload_event, "Upload input");
+		}
 
-		// Call all kernels in a sequence
-		queue.enqueueNDRangeKernel(kernel_1, cl::NullRange, cl::NDRange(input_elements), cl::NDRange(local_size), NULL, &reduce_add_exe_event);
+		// Fill the padding at the end of the input vector with the neutral value
+		if (input_elements > rows)
+		{
+			cl::Event pad_event;
+			if (fixed_point)
+				queue.enqueueFillBuffer(buffer_A, FIXED_PAD, data_size, input_size - data_size, NULL, &pad_event);
+			else
+				queue.enqueueFillBuffer(buffer_A, pad, data_size, input_size - data_size, NULL, &pad_event);
+			input_ready.push_back(pad_event);
+			TraceCommand(trace, pad_event, "Fill input padding");
+		}
 
-		// Copy the calculated result from the device back to the host (store the result in the output vector in host)
-		queue.enqueueReadBuffer(buffer_B, CL_TRUE, 0, output_size, &B[0], NULL, &reduce_add_mem_event_2);
+		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+		////////////////////////////////////////////////////// FUSED STATISTICS KERNEL ///////////////////////////////////////////////////////////////
+		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-		// Store execution time of kernel
-		unsigned long reduce_add_ns = reduce_add_exe_event.getProfilingInfo<CL_PROFILING_COMMAND_END>() - reduce_add_exe_event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+		// Kernels responsible for the count, mean, sum of squared differences, min and max in a single pass over the data,
+		// and for the distribution of the data (0.1 degree bins), which answers any percentile
+		cl::Device device = context.getInfo<CL_CONTEXT_DEVICES>()[0];
+		SummaryKernels summary = CreateSummaryKernels(program, device, fixed_point);
 
-		// Store memory transfer time
-		mex1 = reduce_add_mem_event_1.getProfilingInfo<CL_PROFILING_COMMAND_END>() - reduce_add_mem_event_1.getProfilingInfo<CL_PROFILING_COMMAND_START>();
-		mex2 = reduce_add_mem_event_2.getProfilingInfo<CL_PROFILING_COMMAND_END>() - reduce_add_mem_event_2.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+		// Every work-item strides over several elements, so use large workgroups and only enough of them to fill the device
+		// (or the workgroup size and elements per work-item tuned for the device; the fixed-point reduction is not tuned)
+		if (tuned)
+		{
+			summary.stats_local = fixed_point ? min(summary.stats_local, tuning.stats_local) : tuning.stats_local;
+			summary.stats_items = fixed_point ? 0 : tuning.stats_items;
+			summary.histogram_local = tuning.histogram_local;
+			summary.histogram_items = tuning.histogram_items;
+		}
+		SummaryBuffers summary_buffers = CreateSummaryBuffers(context, summary, rows);
 
-		unsigned long reduce_add_mem = mex2 + mex1;
-		unsigned long reduce_add_op = reduce_add_mem + reduce_add_ns;
+		// Copy the calculated result from the device back to the host (non-blocking, synchronised with the other stages below)
+		Stats stats;
+		FixedStats fixed_stats;
+		cl::Event fixed_stats_clear_event;
 
-		string reduce_add_full = GetFullProfilingInfo(reduce_add_exe_event, ProfilingResolution::PROF_US);
+		if (fixed_point)
+		{
+			EnqueueStatistics(queue, summary, buffer_A, rows, summary_buffers, input_ready, fixed_stats, reduce_statistics_exe_events, fixed_stats_clear_event, reduce_statistics_mem_event);
+			TraceCommand(trace, fixed_stats_clear_event, "Clear statistics");
+			TraceCommand(trace, reduce_statistics_exe_events[0], "reduce_statistics_fixed");
+		}
+		else
+		{
+			EnqueueStatistics(queue, summary, buffer_A, rows, summary_buffers, input_ready, stats, reduce_statistics_exe_events, reduce_statistics_mem_event);
+			TraceCommand(trace, reduce_statistics_exe_events[0], "reduce_statistics");
+			TraceCommand(trace, reduce_statistics_exe_events[1], "combine_statistics");
+		}
+		TraceCommand(trace, reduce_statistics_mem_event, "Read statistics");
 
-		// Copy calculated sum into a new float variable
-		float total = B[0];
+		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+		///////////////////////////////////////////////////////// HISTOGRAM KERNEL ///////////////////////////////////////////////////////////////////
+		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-		// Divide the sum by the total elements in serial to calculate the average
-		mean = total / input_elements;
+		cl::Event histogram_clear_event, histogram_exe_event, histogram_mem_event;
+		vector<cl_uint> histogram(HISTOGRAM_BINS);
+		EnqueueHistogram(queue, summary, buffer_A, rows, summary_buffers, input_ready, &histogram[0], histogram_clear_event, histogram_exe_event, histogram_mem_event);
+		TraceCommand(trace, histogram_clear_event, "Clear histogram");
+		TraceCommand(trace, histogram_exe_event, fixed_point ? "histogram_fixed" : "histogram");
+		TraceCommand(trace, histogram_mem_event, "Read histogram");
 
 		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-		///////////////////////////////////////////////// PARALLEL STANDARD DEVIATION KERNEL /////////////////////////////////////////////////////////
+		/////////////////////////////////////////////////////// PARALLEL SORT KERNEL /////////////////////////////////////////////////////////////////
 		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-		// Copy the input vector to the device memory
-		queue.enqueueWriteBuffer(buffer_A, CL_TRUE, 0, input_size, &A[0], NULL, &reduce_standard_deviation_mem_event_1);
+		// Each sort command waits for the previous one (and the first one for the upload)
+		vector<cl::Event> sort_wait = input_ready;
 
-		// Initialise output vector on the device memory (zero buffer)
-		queue.enqueueFillBuffer(buffer_B, 0, 0, output_size);//zero B buffer on device memory
+		// Prefix and remaining rank of each rank in the radix select (kept alive until the final synchronisation)
+		vector<cl_uint> select_prefix;
+		vector<cl_uint> select_remaining;
 
-		// Re-use previous kernel
-		// Kernel responsible for the parallel standard deviation calculation
-		kernel_1 = cl::Kernel(program, "reduce_standard_deviation");
-		kernel_1.setArg(0, buffer_A);
-		kernel_1.setArg(1, buffer_B);
-		kernel_1.setArg(2, cl::Local(local_size * sizeof(float))); // local memory size
-		kernel_1.setArg(3, mean); // pass previously calculated mean as an argument
-		kernel_1.setArg(4, pad); // padding size
+		// Buffer of the sorted data and its mapping, with zero-copy buffers (unmapped once the order statistics are read)
+		cl::Buffer buffer_sorted;
+		const void* sorted_map = nullptr;
 
-		// Call all kernels in a sequence
-		queue.enqueueNDRangeKernel(kernel_1, cl::NullRange, cl::NDRange(input_elements), cl::NDRange(local_size),NULL,&reduce_standard_deviation_exe_event);
+		// Sorted data is mapped from buffers allocated in host memory (zero-copy), otherwise read back into B or B_fixed
+		cl_mem_flags sorted_host_flags = zero_copy ? CL_MEM_ALLOC_HOST_PTR : 0;
 
-		// Copy the calculated result from the device back to the host (store the result in the output vector in host)
-		queue.enqueueReadBuffer(buffer_B, CL_TRUE, 0, output_size, &B[0], NULL, &reduce_standard_deviation_mem_event_2);
+		if (sort_kernel == "selection")
+		{
+			// Establish a buffer which will be used for the output vector, ensure write-only to avoid kernels unnecessarily interpreting it as the input vector
+			cl::Buffer buffer_B(context, CL_MEM_WRITE_ONLY | sorted_host_flags, output_size);
+
+			// Kernel responsible for the sorting required for the median, LQ, UQ, min and max
+			cl::Kernel kernel_1 = cl::Kernel(program, "parallel_selection_sort");
+			kernel_1.setArg(0, buffer_A);
+			kernel_1.setArg(1, buffer_B);
+
+			// Call all kernels in a sequence
+			sort_exe_events.push_back(cl::Event());
+			queue.enqueueNDRangeKernel(kernel_1, cl::NullRange, cl::NDRange(input_elements), cl::NDRange(local_size), &sort_wait, &sort_exe_events.back());
+			sort_wait = { sort_exe_events.back() };
+			TraceCommand(trace, sort_exe_events.back(), "parallel_selection_sort");
+
+			// Copy the calculated result from the device back to the host (store the result in the output vector in host)
+			sort_mem_events.push_back(cl::Event());
+			if (zero_copy)
+			{
+				buffer_sorted = buffer_B;
+				sorted_map = queue.enqueueMapBuffer(buffer_B, CL_FALSE, CL_MAP_READ, 0, output_size, &sort_wait, &sort_mem_events.back());
+			}
+			else
+			{
+				B.resize(input_elements);
+				queue.enqueueReadBuffer(buffer_B, CL_FALSE, 0, output_size, &B[0], &sort_wait, &sort_mem_events.back());
+			}
+			TraceCommand(trace, sort_mem_events.back(), zero_copy ? "Map sorted data" : "Read sorted data");
+		}
+		else if (sort_kernel == "bitonic")
+		{
+			// Bitonic sort needs a power of two number of elements (at least one full block of 2 * local_size)
+			size_t sort_elements = 2 * local_size;
+			while (sort_elements < input_elements)
+				sort_elements *= 2;
+
+			// The sort runs in place, so it needs its own read-write buffer (padded with the neutral value, which sorts last)
+			cl::Buffer buffer_S(context, CL_MEM_READ_WRITE | sorted_host_flags, sort_elements * element_size);
+			sort_mem_events.push_back(cl::Event());
+			queue.enqueueCopyBuffer(buffer_A, buffer_S, 0, 0, input_size, &sort_wait, &sort_mem_events.back());
+			sort_wait = { sort_mem_events.back() };
+			TraceCommand(trace, sort_mem_events.back(), "Copy input to sort buffer");
+
+			if (sort_elements > input_elements)
+			{
+				cl::Event fill_event;
+				if (fixed_point)
+					queue.enqueueFillBuffer(buffer_S, FIXED_PAD, input_size, (sort_elements - input_elements) * element_size, NULL, &fill_event);
+				else
+					queue.enqueueFillBuffer(buffer_S, pad, input_size, (sort_elements - input_elements) * element_size, NULL, &fill_event);
+				sort_wait.push_back(fill_event);
+				TraceCommand(trace, fill_event, "Fill sort padding");
+			}
+
+			EnqueueBitonicSort(queue, fixed_point ? fixed_sort_program : program, buffer_S, element_size, sort_elements, local_size, sort_wait, sort_exe_events);
+
+			// The first launch sorts the blocks, every other one is a merge step
+			for (size_t e = 0; e < sort_exe_events.size(); e++)
+				TraceCommand(trace, sort_exe_events[e], e == 0 ? "bitonic_sort_local" : "bitonic merge step " + to_string(e));
+
+			// Copy the sorted data (without the extra padding) from the device back to the host
+			sort_mem_events.push_back(cl::Event());
+			if (zero_copy)
+			{
+				buffer_sorted = buffer_S;
+				sorted_map = queue.enqueueMapBuffer(buffer_S, CL_FALSE, CL_MAP_READ, 0, output_size, &sort_wait, &sort_mem_events.back());
+			}
+			else
+			{
+				void* sorted;
+				if (fixed_point)
+				{
+					B_fixed.resize(input_elements);
+					sorted = &B_fixed[0];
+				}
+				else
+				{
+					B.resize(input_elements);
+					sorted = &B[0];
+				}
+				queue.enqueueReadBuffer(buffer_S, CL_FALSE, 0, output_size, sorted, &sort_wait, &sort_mem_events.back());
+			}
+			TraceCommand(trace, sort_mem_events.back(), zero_copy ? "Map sorted data" : "Read sorted data");
+		}
+		else if (sort_kernel == "select")
+		{
+			// Radix select: find the requested ranks directly, 8 bits of the (order-preserving) keys per pass,
+			// without sorting and without reading back the data
+			cl::Kernel select_kernel = cl::Kernel(program, "radix_select_histogram");
+			cl::Kernel narrow_kernel = cl::Kernel(program, "radix_select_narrow");
+
+			// Every work-item strides over several elements, so use large workgroups and only enough of them to fill the device
+			size_t select_local = min((size_t)256, select_kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device));
+			size_t select_groups = min((rows + select_local - 1) / select_local, (size_t)device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>() * 4);
+			select_groups = max(select_groups, (size_t)1);
+
+			size_t nr_ranks = ranks.size();
+			size_t histogram_size = nr_ranks * 256 * sizeof(cl_uint);
+			select_prefix.assign(nr_ranks, 0);
+			select_remaining.assign(ranks.begin(), ranks.end());
+
+			// The prefix and the remaining rank of every rank stay on the device between passes
+			cl::Buffer buffer_prefix(context, CL_MEM_READ_WRITE, nr_ranks * sizeof(cl_uint));
+			cl::Buffer buffer_remaining(context, CL_MEM_READ_WRITE, nr_ranks * sizeof(cl_uint));
+			cl::Buffer buffer_H(context, CL_MEM_READ_WRITE, histogram_size);
+
+			cl::Event prefix_event, remaining_event;
+			queue.enqueueFillBuffer(buffer_prefix, (cl_uint)0, 0, nr_ranks * sizeof(cl_uint), NULL, &prefix_event);
+			queue.enqueueWriteBuffer(buffer_remaining, CL_FALSE, 0, nr_ranks * sizeof(cl_uint), &select_remaining[0], NULL, &remaining_event);
+			sort_wait.push_back(prefix_event);
+			sort_wait.push_back(remaining_event);
+			TraceCommand(trace, prefix_event, "Clear select prefixes");
+			TraceCommand(trace, remaining_event, "Upload select ranks");
+
+			select_kernel.setArg(0, buffer_A);
+			select_kernel.setArg(1, buffer_H);
+			select_kernel.setArg(2, buffer_prefix);
+			select_kernel.setArg(3, cl::Local(histogram_size));
+			select_kernel.setArg(4, (cl_int)rows);
+			select_kernel.setArg(5, (cl_int)nr_ranks);
+
+			narrow_kernel.setArg(0, buffer_H);
+			narrow_kernel.setArg(1, buffer_prefix);
+			narrow_kernel.setArg(2, buffer_remaining);
+
+			for (int shift = 24; shift >= 0; shift -= 8)
+			{
+				// Only keys which share the digits selected so far are counted
+				cl_uint mask = (shift == 24) ? 0 : (0xFFFFFFFFu << (shift + 8));
+				select_kernel.setArg(6, mask);
+				select_kernel.setArg(7, (cl_int)shift);
+				narrow_kernel.setArg(3, (cl_int)shift);
+
+				cl::Event clear_event;
+				queue.enqueueFillBuffer(buffer_H, (cl_uint)0, 0, histogram_size, &sort_wait, &clear_event);
+				sort_wait = { clear_event };
+				TraceCommand(trace, clear_event, "Clear select histogram");
+
+				sort_exe_events.push_back(cl::Event());
+				queue.enqueueNDRangeKernel(select_kernel, cl::NullRange, cl::NDRange(select_groups * select_local), cl::NDRange(select_local), &sort_wait, &sort_exe_events.back());
+				sort_wait = { sort_exe_events.back() };
+				TraceCommand(trace, sort_exe_events.back(), "radix_select_histogram (bits " + to_string(shift) + "+)");
+
+				// Pick the bucket holding each rank and narrow its prefix (on the device, one work-item per rank)
+				sort_exe_events.push_back(cl::Event());
+				queue.enqueueNDRangeKernel(narrow_kernel, cl::NullRange, cl::NDRange(nr_ranks), cl::NullRange, &sort_wait, &sort_exe_events.back());
+				sort_wait = { sort_exe_events.back() };
+				TraceCommand(trace, sort_exe_events.back(), "radix_select_narrow (bits " + to_string(shift) + "+)");
+			}
+
+			// Only the prefixes (i.e. the selected keys) cross the bus
+			sort_mem_events.push_back(cl::Event());
+			queue.enqueueReadBuffer(buffer_prefix, CL_FALSE, 0, nr_ranks * sizeof(cl_uint), &select_prefix[0], &sort_wait, &sort_mem_events.back());
+			TraceCommand(trace, sort_mem_events.back(), "Read selected keys");
+		}
+		else
+		{
+			cout << "Unknown sort kernel: " << sort_kernel << endl;
+			print_help();
+			getchar();
+			return 1;
+		}
 
-		// Store execution time of kernel
-		unsigned long reduce_standard_deviation_ns = reduce_standard_deviation_exe_event.getProfilingInfo<CL_PROFILING_COMMAND_END>() - reduce_standard_deviation_exe_event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+		//////////////////////////////////////////////////////////// SYNCHRONISE /////////////////////////////////////////////////////////////////////
+		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-		// Store memory transfer time
-		mex1 = reduce_standard_deviation_mem_event_1.getProfilingInfo<CL_PROFILING_COMMAND_END>() - reduce_standard_deviation_mem_event_1.getProfilingInfo<CL_PROFILING_COMMAND_START>();
-		mex2 = reduce_standard_deviation_mem_event_2.getProfilingInfo<CL_PROFILING_COMMAND_END>() - reduce_standard_deviation_mem_event_2.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+		// Nothing above blocks: the host only waits here, for the final result reads of both stages
+		queue.flush();
+		cl::Event::waitForEvents(vector<cl::Event>{ reduce_statistics_mem_event, histogram_mem_event, sort_mem_events.back() });
+		auto pipeline_end = chrono::high_resolution_clock::now();
+		TracePhase(trace, "Enqueue and wait for the pipeline", pipeline_start, pipeline_end);
+
+		unsigned long long pipeline_ns = chrono::duration_cast<chrono::nanoseconds>(pipeline_end - pipeline_start).count();
+
+		// Device time from the start of the upload to the end of the last command
+		vector<cl::Event> pipeline_events = { upload_event, reduce_statistics_mem_event, histogram_clear_event, histogram_exe_event, histogram_mem_event };
+		pipeline_events.insert(pipeline_events.end(), reduce_statistics_exe_events.begin(), reduce_statistics_exe_events.end());
+		if (fixed_point)
+			pipeline_events.push_back(fixed_stats_clear_event);
+		pipeline_events.insert(pipeline_events.end(), sort_exe_events.begin(), sort_exe_events.end());
+		pipeline_events.insert(pipeline_events.end(), sort_mem_events.begin(), sort_mem_events.end());
+
+		// Store execution and memory transfer time of the predicate pushdown (the column uploads and the count read)
+		unsigned long filter_ns = 0;
+		unsigned long filter_mem = 0;
+		if (filtered)
+		{
+			for (auto& filter_event : compaction.kernel_events)
+				filter_ns += filter_event.getProfilingInfo<CL_PROFILING_COMMAND_END>() - filter_event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+			vector<cl::Event> filter_mem_events = filter_upload_events;
+			filter_mem_events.insert(filter_mem_events.end(), compaction.transfer_events.begin(), compaction.transfer_events.end());
+			for (auto& filter_event : filter_mem_events)
+				filter_mem += filter_event.getProfilingInfo<CL_PROFILING_COMMAND_END>() - filter_event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+
+			pipeline_events.insert(pipeline_events.end(), filter_mem_events.begin(), filter_mem_events.end());
+			pipeline_events.insert(pipeline_events.end(), compaction.kernel_events.begin(), compaction.kernel_events.end());
+		}
+		unsigned long filter_op = filter_ns + filter_mem;
 
-		unsigned long reduce_standard_deviation_mem = mex2 + mex1;
-		unsigned long reduce_standard_deviation_op = reduce_standard_deviation_mem + reduce_standard_deviation_ns;
+		unsigned long long pipeline_span_ns = GetProfilingSpan(pipeline_events);
 
-		string reduce_standard_deviation_full = GetFullProfilingInfo(reduce_standard_deviation_exe_event, ProfilingResolution::PROF_US);
+		// Store execution time of both kernels (the single fixed-point kernel merges with atomics instead)
+		unsigned long reduce_statistics_ns = 0;
+		for (auto& reduce_statistics_exe_event : reduce_statistics_exe_events)
+			reduce_statistics_ns += reduce_statistics_exe_event.getProfilingInfo<CL_PROFILING_COMMAND_END>() - reduce_statistics_exe_event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
 
-		// Collect sum of the squared differences
-		float sumsquaredDifference = B[0];
-		float variance = sumsquaredDifference / input_elements;
+		// Store memory transfer time (the single upload is accounted to this stage)
+		mex1 = upload_event.getProfilingInfo<CL_PROFILING_COMMAND_END>() - upload_event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+		mex2 = reduce_statistics_mem_event.getProfilingInfo<CL_PROFILING_COMMAND_END>() - reduce_statistics_mem_event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
 
-		// Square-root the average of the square differences in serial
-		stdDev = sqrt(variance);
+		unsigned long reduce_statistics_mem = mex2 + mex1;
+		unsigned long reduce_statistics_op = reduce_statistics_mem + reduce_statistics_ns;
 
-		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-		/////////////////////////////////////////////////////// PARALLEL SORT KERNEL /////////////////////////////////////////////////////////////////
-		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+		string reduce_statistics_full = GetFullProfilingInfo(reduce_statistics_exe_events, ProfilingResolution::PROF_US);
 
-		// Copy the input vector to the device memory
-		queue.enqueueWriteBuffer(buffer_A, CL_TRUE, 0, input_size, &A[0], NULL, &sort_mem_event_1);
+		// The mean and the sum of squared differences come straight from the kernel (or from its exact sums)
+		if (fixed_point)
+			stats = FixedToStats(fixed_stats);
+		mean = stats.mean;
+		stdDev = sqrt(StatsVariance(stats));
 
-		// Initialise output vector on the device memory (zero buffer)
-		queue.enqueueFillBuffer(buffer_B, 0, 0, output_size);//zero B buffer on device memory
+		// Store execution time of every kernel launch involved in the sort
+		unsigned long sort_ns = 0;
+		for (auto& sort_exe_event : sort_exe_events)
+			sort_ns += sort_exe_event.getProfilingInfo<CL_PROFILING_COMMAND_END>() - sort_exe_event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
 
-		// (Re-use previous kernel)
-		// Kernel responsible for the sorting required for the median, LQ, UQ, min and max
-		kernel_1 = cl::Kernel(program, "parallel_selection_sort");
-		kernel_1.setArg(0, buffer_A);
-		kernel_1.setArg(1, buffer_B);
+		// Store memory transfer time
+		unsigned long sort_mem = 0;
+		for (auto& sort_mem_event : sort_mem_events)
+			sort_mem += sort_mem_event.getProfilingInfo<CL_PROFILING_COMMAND_END>() - sort_mem_event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+		unsigned long sort_op = sort_mem + sort_ns;
 
-		// Call all kernels in a sequence
-		queue.enqueueNDRangeKernel(kernel_1, cl::NullRange, cl::NDRange(input_elements), cl::NDRange(local_size), NULL, &sort_exe_event);
-		
-		// Copy the calculated result from the device back to the host (store the result in the output vector in host)
-		queue.enqueueReadBuffer(buffer_B, CL_TRUE, 0, output_size, &B[0], NULL, &sort_mem_event_2);
+		// Order statistics, either read from the sorted data (or its mapping) or selected directly
+		const cl_short* sorted_fixed = sorted_map ? (const cl_short*)sorted_map : B_fixed.data();
+		const float* sorted_floats = sorted_map ? (const float*)sorted_map : B.data();
+		for (size_t r = 0; r < ranks.size(); r++)
+			order_stats[r] = (sort_kernel == "select") ? keyToFloat(select_prefix[r]) : fixed_point ? DecodeTenths(sorted_fixed[ranks[r]]) : sorted_floats[ranks[r]];
+
+		if (sorted_map)
+		{
+			queue.enqueueUnmapMemObject(buffer_sorted, (void*)sorted_map);
+			queue.finish();
+		}
 
-		// Store execution time of kernel
-		unsigned long sort_ns = sort_exe_event.getProfilingInfo<CL_PROFILING_COMMAND_END>() - sort_exe_event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+		string sort_full = GetFullProfilingInfo(sort_exe_events, ProfilingResolution::PROF_US);
 
-		// Store memory transfer time
-		mex1 = sort_mem_event_1.getProfilingInfo<CL_PROFILING_COMMAND_END>() - sort_mem_event_1.getProfilingInfo<CL_PROFILING_COMMAND_START>();
-		mex2 = sort_mem_event_2.getProfilingInfo<CL_PROFILING_COMMAND_END>() - sort_mem_event_2.getProfilingInfo<CL_PROFILING_COMMAND_START>();
-		unsigned long sort_mem = mex2 + mex1;
-		unsigned long sort_op = sort_mem + sort_ns;
+		// Store execution and memory transfer time of the histogram
+		unsigned long histogram_ns = histogram_exe_event.getProfilingInfo<CL_PROFILING_COMMAND_END>() - histogram_exe_event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+		unsigned long histogram_mem = histogram_mem_event.getProfilingInfo<CL_PROFILING_COMMAND_END>() - histogram_mem_event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+		unsigned long histogram_op = histogram_ns + histogram_mem;
 
-		string sort_full = GetFullProfilingInfo(sort_exe_event, ProfilingResolution::PROF_US);
+		// Any percentile is a search in the prefix sum of the bins
+		vector<uint64_t> cumulative = HistogramPrefixSum(histogram);
+
+		// Write the distribution (every non-empty bin) if requested
+		if (!distribution_file.empty())
+		{
+			ofstream distribution(distribution_file);
+			distribution << "temperature,count" << endl;
+			for (size_t b = 0; b < histogram.size(); b++)
+			{
+				if (histogram[b])
+					distribution << HistogramBinValue(b) << "," << histogram[b] << endl;
+			}
+			if (!distribution)
+				cout << "Could not write the distribution file (" << distribution_file << ")" << endl;
+		}
 
 		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 		/////////////////////////////////////////////////////////// OUTPUT RESULTS ///////////////////////////////////////////////////////////////////
 		//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 		unsigned long totalElapsed = 0;
-		totalElapsed = reduce_add_op + reduce_standard_deviation_op + sort_op;
+		totalElapsed = filter_op + reduce_statistics_op + histogram_op + sort_op;
 
 		cout << endl;
 		cout << "---------------------------------- Performance Results ---------------------------------" << endl;
-		cout << "Addition by reduction kernel: " << endl;
-		cout << "\tKernel execution time: " << reduce_add_ns << " [ns]" << endl;
-		cout << "\tMemory transfer: " << reduce_add_mem << " [ns]" << endl;
-		cout << "\tOperation time: " << reduce_add_op << " [ns]" << endl;
-		cout << "\t" << reduce_add_full << endl;
+		cout << (from_cache ? "Data loading (binary cache): " : "Data loading (memory-mapped parser): ") << endl;
+		cout << "\tRows loaded: " << weather.rows << endl;
+		cout << "\tLoad time: " << load_ns << " [ns]" << endl;
+		cout << "\tThroughput: " << (unsigned long long)load_rows_per_s << " [rows/s]" << endl;
 		cout << endl;
-		cout << "Sum of squared differences kernel: " << endl;
-		cout << "\tKernel execution time: " << reduce_standard_deviation_ns << " [ns]" << endl;
-		cout << "\tMemory transfer: " << reduce_standard_deviation_mem << " [ns]" << endl;
-		cout << "\tOperation time: " << reduce_standard_deviation_op << " [ns]" << endl;
-		cout << "\t" << reduce_standard_deviation_full << endl;
+		cout << (program_from_cache ? "Program load (cached binary): " : "Program build (from source): ") << build_ns << " [ns]" << endl;
+		if (tuned)
+			cout << "Workgroup sizes (tuned for this device): " << tuning_options << endl;
+		else
+			cout << "Workgroup sizes: defaults (run with -T to tune them for this device)" << endl;
+		if (zero_copy)
+			cout << "Zero-copy buffers: the device uses the host columns in place and the sorted data is mapped" << endl;
+		cout << endl;
+		if (fixed_point)
+		{
+			cout << "Fixed-point storage (int16 tenths of a degree): " << endl;
+			cout << "\tEncode time: " << encode_ns << " [ns]" << endl;
+			cout << "\tInput vector: " << data_size << " [bytes] (" << rows * sizeof(float) << " as floats)" << endl;
+			cout << endl;
+		}
+		if (filtered)
+		{
+			cout << "Predicate pushdown (filter " << filter_text << "; flags, exclusive scan, compaction): " << endl;
+			cout << "\tMatching rows: " << rows << " of " << total_rows << endl;
+			cout << "\tKernel launches: " << compaction.kernel_events.size() << endl;
+			cout << "\tKernel execution time: " << filter_ns << " [ns]" << endl;
+			cout << "\tMemory transfer: " << filter_mem << " [ns]" << endl;
+			cout << "\tOperation time: " << filter_op << " [ns]" << endl;
+			cout << endl;
+		}
+		if (fixed_point)
+			cout << "Fused statistics kernel (count, exact integer sums, min, max; merged with native atomics): " << endl;
+		else
+			cout << "Fused statistics kernel (count, sum, M2, min, max): " << endl;
+		cout << "\tKernel execution time: " << reduce_statistics_ns << " [ns]" << endl;
+		cout << "\tMemory transfer: " << reduce_statistics_mem << " [ns]" << endl;
+		cout << "\tOperation time: " << reduce_statistics_op << " [ns]" << endl;
+		cout << "\t" << reduce_statistics_full << endl;
 
 		cout << endl;
-		cout << "Selection sort in parallel kernel: " << endl;
+		cout << "Histogram kernel (" << HISTOGRAM_BINS << " bins, local memory privatised): " << endl;
+		cout << "\tKernel execution time: " << histogram_ns << " [ns]" << endl;
+		cout << "\tMemory transfer: " << histogram_mem << " [ns]" << endl;
+		cout << "\tOperation time: " << histogram_op << " [ns]" << endl;
+
+		cout << endl;
+		if (sort_kernel == "selection")
+			cout << "Selection sort in parallel kernel: " << endl;
+		else if (sort_kernel == "bitonic")
+			cout << (fixed_point ? "Bitonic sort kernels (int16 keys): " : "Bitonic sort kernels: ") << endl;
+		else
+			cout << "Radix select kernel (order statistics without sorting): " << endl;
+		cout << "\tKernel launches: " << sort_exe_events.size() << endl;
 		cout << "\tKernel execution time: " << sort_ns << " [ns]" << endl;
 		cout << "\tMemory transfer: " << sort_mem << " [ns]" << endl;
 		cout << "\tOperation time: " << sort_op << " [ns]" << endl;
@@ -330,14 +1582,15 @@ int main(int argc, char **argv)
 
 		cout << endl;
 		cout << "Total program execution time: " << totalElapsed << " [ns]" << endl;
+		cout << "Pipeline wall time (upload to final read, " << (out_of_order ? "out-of-order" : "in-order") << " queue): " << pipeline_ns << " [ns]" << endl;
+		cout << "Pipeline device time span: " << pipeline_span_ns << " [ns]" << endl;
 		cout << "----------------------- Statistical Analysis Calculation Results -----------------------" << endl;
 
-		sorted_temp = B;
-		_min = sorted_temp[0];
-		_max = sorted_temp[vector_elements - 1];
-		median = sorted_temp[vector_elements / 2 - 1];
-		firstQuart = sorted_temp[(vector_elements / 4) - 1];
-		thirdQuart = sorted_temp[(vector_elements / 2) + (vector_elements / 4)];
+		_min = stats.min;
+		firstQuart = order_stats[1];
+		median = order_stats[2];
+		thirdQuart = order_stats[3];
+		_max = stats.max;
 
 		cout << "Mean: " << mean << endl;
 		cout << "Standard Deviation: " << stdDev << endl;
@@ -346,6 +1599,17 @@ int main(int argc, char **argv)
 		cout << "Median: " << median << endl;
 		cout << "First Quartile: " << firstQuart << endl;
 		cout << "Third Quartile: " << thirdQuart << endl;
+		for (double percentile : percentiles)
+			cout << "Percentile " << percentile << ": " << HistogramPercentile(cumulative, percentile) << endl;
+
+		// Write the timeline of the run if requested
+		if (trace.enabled)
+		{
+			if (WriteChromeTrace(trace, trace_file))
+				cout << endl << "Timeline of " << trace.commands.size() << " commands written to " << trace_file << " (open it in Perfetto or chrome://tracing)" << endl;
+			else
+				cout << endl << "Could not write the trace file (" << trace_file << ")" << endl;
+		}
 
 		cout << endl;
 		cout << "Please enter any key to exit... ";
@@ -365,6 +1629,29 @@ void print_help() {
 
 	std::cerr << "  -p : select platform " << std::endl;
 	std::cerr << "  -d : select device" << std::endl;
+	std::cerr << "  -s : select sort kernel (bitonic, selection, select = order statistics without a sort)" << std::endl;
+	std::cerr << "  -n : use the native multi-threaded, vectorised host backend instead of OpenCL" << std::endl;
+	std::cerr << "  -m : split the data across every device of the platform (CPU devices by NUMA node)" << std::endl;
+	std::cerr << "  -o : use an out-of-order queue (independent stages run concurrently)" << std::endl;
+	std::cerr << "  -z : zero-copy buffers over host memory on CPU and integrated devices (no upload or read-back copies)" << std::endl;
+	std::cerr << "  -i : store the temperatures as int16 tenths of a degree (half the bytes, integer kernels; bitonic sort only)" << std::endl;
+	std::cerr << "  -q : percentiles to report, from the histogram (comma separated, e.g. 1,50,99)" << std::endl;
+	std::cerr << "  -H : write the distribution (temperature,count per 0.1 degree bin) to this CSV file" << std::endl;
+	std::cerr << "  -t : write a timeline of every command and host phase to this Chrome trace JSON file (Perfetto)" << std::endl;
+	std::cerr << "  -g : statistics per group instead of the whole file (station, year, month = station x month)" << std::endl;
+	std::cerr << "  -f : only the rows matching these filters, evaluated on the device (e.g. station=X,year=2010 or from=2010-01 to=2010-06)" << std::endl;
+	std::cerr << "  -R : rolling mean and standard deviation of every station over these windows (comma separated days, e.g. 7,30)" << std::endl;
+	std::cerr << "  -S : query server, answers requests from stdin with the data kept resident (e.g. stats station=X year=2010)" << std::endl;
+	std::cerr << "  -b : batch mode, statistics of every one of these files through one engine (comma separated file names)" << std::endl;
+	std::cerr << "  -a : incremental mode, only the rows appended since the last run are processed (state kept in <file>.state)" << std::endl;
+	std::cerr << "  -k : approximate median and quartiles from a mergeable sketch within this relative rank error (e.g. 0.01), in one streaming pass" << std::endl;
+	std::cerr << "  -K : merge the sketch and statistics with those saved in this file by earlier runs, and save the result there (with -k)" << std::endl;
+	std::cerr << "  -c : stream the data through the device in chunks of this many rows (fixed memory footprint)" << std::endl;
+	std::cerr << "  -T : autotune the workgroup sizes of the pipeline for this device (saved in autotune.profile, used by later runs)" << std::endl;
+	std::cerr << "  -B : benchmark mode, over synthetic data sets of these sizes (comma separated rows, or default = 10K to 100M)" << std::endl;
+	std::cerr << "  -r : benchmark (and autotune) repetitions of every stage (default 10)" << std::endl;
+	std::cerr << "  -w : benchmark (and autotune) warm-up runs, not measured (default 2)" << std::endl;
+	std::cerr << "  -F : benchmark output format, csv or json (written to benchmark.csv / benchmark.json)" << std::endl;
 	std::cerr << "  -l : list all platforms and devices" << std::endl;
 	std::cerr << "  -h : print this message" << std::endl;
 }
@@ -382,4 +1669,29 @@ vector<float> quickDelete(vector<float>vec, float pad)
 	return vec;
 }
 
-/*end of script*/
\ No newline at end of file
+/*end of script*/
+
+// Function responsible for converting an order-preserving sort key (see float_to_key in my_kernels.cl) back to a float
+float keyToFloat(unsigned int key)
+{
+	unsigned int bits = (key & 0x80000000) ? (key & 0x7FFFFFFF) : ~key;
+	float value;
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+// Parse a comma separated list of percentiles (e.g. "5,50,95"), ignoring values outside 0 to 100
+vector<double> parsePercentiles(const char* list)
+{
+	vector<double> percentiles;
+	stringstream items(list);
+	string item;
+
+	while (getline(items, item, ','))
+	{
+		double percentile = atof(item.c_str());
+		if (percentile >= 0.0 && percentile <= 100.0)
+			percentiles.push_back(percentile);
+	}
+	return percentiles;
+}
@@ -0,0 +1,151 @@
+/* Statistics.h | Mergeable summary statistics shared by the host and the kernels */
+
+#pragma once
+
+#include <cstdint>
+#include <cmath>
+#include <limits>
+#include <vector>
+#include <algorithm>
+
+using namespace std;
+
+// Mergeable statistics of a set of values (count, mean, sum of squared differences from the mean, min and max)
+// Must match the layout of the Stats struct in my_kernels.cl
+struct Stats {
+	uint32_t count;
+	float mean;
+	float m2;
+	float min;
+	float max;
+};
+
+Stats EmptyStats() {
+	Stats empty = { 0, 0.f, 0.f, numeric_limits<float>::infinity(), -numeric_limits<float>::infinity() };
+	return empty;
+}
+
+// Merge two sets of statistics (Chan et al. parallel update, same as stats_merge in my_kernels.cl)
+Stats MergeStats(const Stats& a, const Stats& b) {
+	if (b.count == 0) return a;
+	if (a.count == 0) return b;
+
+	double count = (double)a.count + (double)b.count;
+	double delta = (double)b.mean - (double)a.mean;
+
+	Stats result;
+	result.count = a.count + b.count;
+	result.mean = (float)(a.mean + delta * (b.count / count));
+	result.m2 = (float)(a.m2 + b.m2 + delta * delta * ((double)a.count * (double)b.count / count));
+	result.min = fmin(a.min, b.min);
+	result.max = fmax(a.max, b.max);
+	return result;
+}
+
+// Population variance of a set of statistics
+float StatsVariance(const Stats& stats) {
+	return stats.count ? stats.m2 / stats.count : 0.f;
+}
+
+// Statistics of any number of rows (merged over many chunks or runs): a 64-bit count, and the sum and the sum of
+// squared differences from the mean in double, so that neither wraps nor loses precision as the rows add up
+struct TotalStats {
+	uint64_t count;
+	double sum;
+	double m2;
+	float min;
+	float max;
+};
+
+TotalStats EmptyTotalStats() {
+	TotalStats empty = { 0, 0.0, 0.0, numeric_limits<float>::infinity(), -numeric_limits<float>::infinity() };
+	return empty;
+}
+
+// Widen the statistics of one set of rows (e.g. one launch of the fused statistics kernels)
+TotalStats WidenStats(const Stats& stats) {
+	TotalStats total = { stats.count, (double)stats.mean * stats.count, stats.m2, stats.min, stats.max };
+	return total;
+}
+
+// Merge two sets of total statistics (same update as MergeStats, in 64-bit and double)
+TotalStats MergeTotalStats(const TotalStats& a, const TotalStats& b) {
+	if (b.count == 0) return a;
+	if (a.count == 0) return b;
+
+	double count = (double)a.count + (double)b.count;
+	double delta = b.sum / b.count - a.sum / a.count;
+
+	TotalStats result;
+	result.count = a.count + b.count;
+	result.sum = a.sum + b.sum;
+	result.m2 = a.m2 + b.m2 + delta * delta * ((double)a.count * (double)b.count / count);
+	result.min = fmin(a.min, b.min);
+	result.max = fmax(a.max, b.max);
+	return result;
+}
+
+double TotalStatsMean(const TotalStats& stats) {
+	return stats.count ? stats.sum / stats.count : 0.0;
+}
+
+// Population variance of a set of total statistics
+double TotalStatsVariance(const TotalStats& stats) {
+	return stats.count ? stats.m2 / stats.count : 0.0;
+}
+
+// Ranks of the min, first quartile, median, third quartile and max within the sorted data
+vector<size_t> OrderStatisticRanks(size_t n) {
+	return { 0, (n / 4) - 1, n / 2 - 1, (n / 2) + (n / 4), n - 1 };
+}
+
+// Fixed binning of the histogram kernel: 0.1 degree bins centred on -100.0, -99.9, ..., 100.0
+// (the data is recorded to 0.1 degrees, so every value in range falls exactly on the centre of a bin)
+const float HISTOGRAM_MIN = -100.f;
+const int HISTOGRAM_BINS_PER_DEGREE = 10;
+const float HISTOGRAM_RESOLUTION = 1.f / HISTOGRAM_BINS_PER_DEGREE;
+const int HISTOGRAM_BINS = 2001;
+
+// Centre of a bin of the histogram (divided in double, so that e.g. bin 1004 is exactly 0.4f)
+inline float HistogramBinValue(size_t bin) {
+	return (float)(HISTOGRAM_MIN + bin / (double)HISTOGRAM_BINS_PER_DEGREE);
+}
+
+// Inclusive prefix sum of the counts of a histogram (the number of values in each bin or below), for the counts of
+// one run (uint32) or accumulated over many runs (uint64, see IncrementalState)
+template<typename Count>
+vector<uint64_t> HistogramPrefixSum(const vector<Count>& histogram) {
+	vector<uint64_t> cumulative(histogram.size());
+	uint64_t total = 0;
+	for (size_t b = 0; b < histogram.size(); b++)
+	{
+		total += histogram[b];
+		cumulative[b] = total;
+	}
+	return cumulative;
+}
+
+// Value at a (0-based) rank of the sorted data, from the prefix sum of its histogram (see OrderStatisticRanks)
+float HistogramRankValue(const vector<uint64_t>& cumulative, uint64_t rank) {
+	uint64_t total = cumulative.empty() ? 0 : cumulative.back();
+	if (total == 0)
+		return 0.f;
+
+	rank = min(rank, total - 1);
+	size_t bin = upper_bound(cumulative.begin(), cumulative.end(), rank) - cumulative.begin();
+	return HistogramBinValue(bin);
+}
+
+// Value at a percentile (0 to 100) of the data, from the prefix sum of its histogram (nearest-rank definition)
+float HistogramPercentile(const vector<uint64_t>& cumulative, double percentile) {
+	uint64_t total = cumulative.empty() ? 0 : cumulative.back();
+	if (total == 0)
+		return 0.f;
+
+	uint64_t rank = (uint64_t)ceil(percentile / 100.0 * total);
+	rank = min(max(rank, (uint64_t)1), total);
+
+	// First bin whose cumulative count reaches the rank
+	size_t bin = lower_bound(cumulative.begin(), cumulative.end(), rank) - cumulative.begin();
+	return HistogramBinValue(bin);
+}
@@ -0,0 +1,323 @@
+/* Streaming.h | Out-of-core mode: the data is streamed through the device in fixed-size chunks */
+
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <chrono>
+#include <climits>
+#include <CL/cl.hpp>
+#include "DataLoader.h"
+#include "Statistics.h"
+#include "Sketch.h"
+#include "Summary.h"
+
+using namespace std;
+
+// Number of device buffers the chunks rotate through, so that the upload of chunk k + 1
+// overlaps the kernels of chunk k (and the host can parse chunk k + 2 in the meantime)
+const size_t STREAM_SLOTS = 3;
+
+// Where the chunks come from: the temperature column of the binary cache (used in place,
+// the OS pages it in and out of the mapping) or the text file (parsed one chunk at a time)
+struct ChunkSource {
+	const float* column = nullptr;
+	size_t rows = 0;
+	size_t next = 0;
+	TemperatureReader reader;
+};
+
+// Start another pass over the source
+void RewindChunkSource(ChunkSource& source) {
+	source.next = 0;
+	if (!source.column)
+		RewindTemperatureReader(source.reader);
+}
+
+// Point data at the next chunk of at most max_rows rows (parsed into staging when reading the text file)
+// Returns the number of rows in the chunk, 0 once the source is exhausted.
+size_t NextChunk(ChunkSource& source, vector<float>& staging, size_t max_rows, const float*& data) {
+	if (source.column)
+	{
+		size_t rows = min(max_rows, source.rows - source.next);
+		data = source.column + source.next;
+		source.next += rows;
+		return rows;
+	}
+
+	staging.resize(max_rows);
+	data = staging.data();
+	return ReadTemperatures(source.reader, staging.data(), max_rows);
+}
+
+// Results and profiling of a streaming run
+struct StreamResult {
+	TotalStats stats;
+	vector<cl_uint> order_keys;		// order-preserving keys of the order statistics (see float_to_key in my_kernels.cl)
+	size_t rows = 0;
+	size_t chunks = 0;				// chunks per pass
+	size_t passes = 0;
+	size_t kernel_launches = 0;
+	size_t sketch_samples = 0;		// samples of the sorted blocks read back for the quantile sketch
+	size_t device_bytes = 0;		// device memory in use, independent of the size of the data
+	unsigned long long upload_ns = 0;
+	unsigned long long kernel_ns = 0;
+	unsigned long long read_ns = 0;
+	unsigned long long wall_ns = 0;
+};
+
+inline unsigned long long EventDuration(const cl::Event& event) {
+	return event.getProfilingInfo<CL_PROFILING_COMMAND_END>() - event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+}
+
+// Stream every row of the source through the device, chunk_rows rows at a time.
+// The first pass reduces each chunk with the fused statistics kernels (the partial statistics are merged on the host)
+// and counts the first digit of the radix select; three more passes over the stream narrow the selection, so the
+// order statistics are exact. The radix select histograms accumulate on the device across the chunks of a pass.
+// With a sketch, the single pass sorts each chunk in blocks on the device instead, and the samples of the blocks
+// (see sketch_compact in my_kernels.cl) are merged into the sketch, which answers the order statistics approximately.
+void StreamStatistics(const cl::Context& context, const cl::Program& program, ChunkSource& source, size_t chunk_rows, StreamResult& result, QuantileSketch* sketch = nullptr) {
+	cl::Device device = context.getInfo<CL_CONTEXT_DEVICES>()[0];
+
+	// Transfers and kernels go to separate queues, so that they can overlap
+	cl::CommandQueue upload_queue(context, device, CL_QUEUE_PROFILING_ENABLE);
+	cl::CommandQueue compute_queue(context, device, CL_QUEUE_PROFILING_ENABLE);
+
+	// Every chunk has to fit in one device allocation, and its size is passed to the kernels as an int
+	size_t max_rows = min((size_t)device.getInfo<CL_DEVICE_MAX_MEM_ALLOC_SIZE>() / sizeof(float), (size_t)INT_MAX);
+	chunk_rows = max((size_t)1, min(chunk_rows, max_rows));
+
+	SummaryKernels summary = CreateSummaryKernels(program, device);
+	cl::Kernel select_kernel = cl::Kernel(program, "radix_select_histogram");
+	cl::Kernel narrow_kernel = cl::Kernel(program, "radix_select_narrow");
+
+	// Workgroups are sized for a full chunk, exactly as for the whole data set
+	size_t max_groups = (size_t)device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>() * 4;
+	size_t select_local = min((size_t)256, select_kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device));
+	size_t select_groups = max((size_t)1, min((chunk_rows + select_local - 1) / select_local, max_groups));
+
+	// Blocks of the sketch are sorted in local memory, so the workgroup is the largest power of two the kernel allows
+	cl::Kernel sketch_kernel;
+	size_t sketch_local = 1;
+	if (sketch)
+	{
+		sketch_kernel = cl::Kernel(program, "sketch_compact");
+		size_t sketch_limit = min((size_t)256, sketch_kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device));
+		while (sketch_local * 2 <= sketch_limit)
+			sketch_local *= 2;
+	}
+	size_t sketch_block = 2 * sketch_local;
+
+	const size_t nr_ranks = 5;
+	size_t histogram_size = nr_ranks * 256 * sizeof(cl_uint);
+
+	// Rotating buffers: the chunk itself, and the partial and combined statistics of its workgroups
+	vector<cl::Buffer> chunk_buffers;
+	vector<SummaryBuffers> summary_buffers;
+	for (size_t slot = 0; slot < STREAM_SLOTS; slot++)
+	{
+		chunk_buffers.push_back(cl::Buffer(context, CL_MEM_READ_ONLY, chunk_rows * sizeof(float)));
+		summary_buffers.push_back(CreateSummaryBuffers(context, summary, chunk_rows, false));
+	}
+	vector<vector<float>> staging(STREAM_SLOTS);
+
+	// Samples of the sorted blocks of each slot, merged into the sketch once read back (at most one per row)
+	vector<cl::Buffer> sample_buffers;
+	vector<vector<float>> samples(STREAM_SLOTS);
+	vector<int> sample_levels(STREAM_SLOTS, 0);
+	vector<size_t> sample_blocks(STREAM_SLOTS, 0);
+	if (sketch)
+	{
+		for (size_t slot = 0; slot < STREAM_SLOTS; slot++)
+			sample_buffers.push_back(cl::Buffer(context, CL_MEM_WRITE_ONLY, chunk_rows * sizeof(float)));
+	}
+
+	auto merge_samples = [&](size_t slot) {
+		if (!sample_blocks[slot])
+			return;
+		SketchAdd(*sketch, samples[slot].data(), samples[slot].size(), sample_levels[slot], sample_levels[slot] ? sample_blocks[slot] : 0);
+		sample_blocks[slot] = 0;
+	};
+
+	// The radix select state stays on the device for the whole run
+	cl::Buffer buffer_prefix(context, CL_MEM_READ_WRITE, nr_ranks * sizeof(cl_uint));
+	cl::Buffer buffer_remaining(context, CL_MEM_READ_WRITE, nr_ranks * sizeof(cl_uint));
+	cl::Buffer buffer_H(context, CL_MEM_READ_WRITE, histogram_size);
+
+	size_t stats_groups = SummaryGroups(chunk_rows, summary.stats_local, summary.stats_items, summary.compute_groups);
+	result.device_bytes = STREAM_SLOTS * (chunk_rows * sizeof(float) + stats_groups * sizeof(Stats) + sizeof(Stats))
+		+ 2 * nr_ranks * sizeof(cl_uint) + histogram_size + sample_buffers.size() * chunk_rows * sizeof(float);
+
+	select_kernel.setArg(1, buffer_H);
+	select_kernel.setArg(2, buffer_prefix);
+	select_kernel.setArg(3, cl::Local(histogram_size));
+	select_kernel.setArg(5, (cl_int)nr_ranks);
+
+	narrow_kernel.setArg(0, buffer_H);
+	narrow_kernel.setArg(1, buffer_prefix);
+	narrow_kernel.setArg(2, buffer_remaining);
+
+	vector<cl::Event> upload_events, kernel_events, read_events;
+
+	// Statistics of every chunk (a deque, so that pending reads never move)
+	deque<Stats> chunk_stats;
+	vector<cl_uint> remaining;
+
+	// Commands still using the host and device buffers of each slot
+	vector<vector<cl::Event>> slot_busy(STREAM_SLOTS);
+	size_t next_slot = 0;
+
+	auto stream_start = chrono::high_resolution_clock::now();
+
+	compute_queue.enqueueFillBuffer(buffer_prefix, (cl_uint)0, 0, nr_ranks * sizeof(cl_uint));
+
+	for (int shift = 24; shift >= 0; shift -= 8)
+	{
+		bool first_pass = (shift == 24);
+
+		// Only keys which share the digits selected so far are counted
+		cl_uint mask = first_pass ? 0 : (0xFFFFFFFFu << (shift + 8));
+		select_kernel.setArg(6, mask);
+		select_kernel.setArg(7, (cl_int)shift);
+		narrow_kernel.setArg(3, (cl_int)shift);
+
+		compute_queue.enqueueFillBuffer(buffer_H, (cl_uint)0, 0, histogram_size);
+
+		RewindChunkSource(source);
+		size_t chunks = 0;
+
+		for (;; chunks++)
+		{
+			size_t slot = next_slot;
+
+			// Only block once every slot is in flight, before reusing the oldest one
+			if (!slot_busy[slot].empty())
+				cl::Event::waitForEvents(slot_busy[slot]);
+			slot_busy[slot].clear();
+			if (sketch)
+				merge_samples(slot);
+
+			const float* data;
+			size_t rows = NextChunk(source, staging[slot], chunk_rows, data);
+			if (rows == 0)
+				break;
+			next_slot = (next_slot + 1) % STREAM_SLOTS;
+
+			if (first_pass)
+				result.rows += rows;
+
+			upload_events.push_back(cl::Event());
+			upload_queue.enqueueWriteBuffer(chunk_buffers[slot], CL_FALSE, 0, rows * sizeof(float), data, NULL, &upload_events.back());
+			upload_queue.flush();
+			vector<cl::Event> uploaded = { upload_events.back() };
+
+			if (sketch)
+			{
+				// Whole blocks are sorted and sampled on the device, the few rows after them go straight into the sketch
+				size_t blocks = rows / sketch_block;
+				SketchAdd(*sketch, data + blocks * sketch_block, rows - blocks * sketch_block, 0, 0);
+
+				if (blocks)
+				{
+					int level = SketchBlockLevel(sketch->error, rows, sketch_block);
+					size_t block_samples = sketch_block >> level;
+					sample_levels[slot] = level;
+					sample_blocks[slot] = blocks;
+					samples[slot].resize(blocks * block_samples);
+
+					sketch_kernel.setArg(0, chunk_buffers[slot]);
+					sketch_kernel.setArg(1, sample_buffers[slot]);
+					sketch_kernel.setArg(2, cl::Local(sketch_block * sizeof(float)));
+					sketch_kernel.setArg(3, (cl_int)(1 << level));
+					sketch_kernel.setArg(4, (cl_uint)SketchRandom(*sketch));
+					kernel_events.push_back(cl::Event());
+					compute_queue.enqueueNDRangeKernel(sketch_kernel, cl::NullRange, cl::NDRange(blocks * sketch_local), cl::NDRange(sketch_local), &uploaded, &kernel_events.back());
+
+					read_events.push_back(cl::Event());
+					compute_queue.enqueueReadBuffer(sample_buffers[slot], CL_FALSE, 0, samples[slot].size() * sizeof(float), samples[slot].data(), NULL, &read_events.back());
+					slot_busy[slot].push_back(read_events.back());
+					result.sketch_samples += samples[slot].size();
+				}
+			}
+			else
+			{
+				select_kernel.setArg(0, chunk_buffers[slot]);
+				select_kernel.setArg(4, (cl_int)rows);
+				kernel_events.push_back(cl::Event());
+				compute_queue.enqueueNDRangeKernel(select_kernel, cl::NullRange, cl::NDRange(select_groups * select_local), cl::NDRange(select_local), &uploaded, &kernel_events.back());
+				slot_busy[slot].push_back(kernel_events.back());
+			}
+
+			if (first_pass)
+			{
+				chunk_stats.push_back(EmptyStats());
+				read_events.push_back(cl::Event());
+				EnqueueStatistics(compute_queue, summary, chunk_buffers[slot], rows, summary_buffers[slot], uploaded, chunk_stats.back(), kernel_events, read_events.back());
+				slot_busy[slot].push_back(read_events.back());
+			}
+
+			compute_queue.flush();
+		}
+
+		if (first_pass)
+		{
+			result.chunks = chunks;
+
+			// Nothing can be selected with fewer rows than quartiles (the caller rejects such a source)
+			if (result.rows < 4)
+				break;
+
+			// The sketch holds every row after a single pass, once the samples still in flight are merged
+			if (sketch)
+			{
+				for (size_t slot = 0; slot < STREAM_SLOTS; slot++)
+				{
+					if (!slot_busy[slot].empty())
+						cl::Event::waitForEvents(slot_busy[slot]);
+					slot_busy[slot].clear();
+					merge_samples(slot);
+				}
+				result.passes++;
+				break;
+			}
+
+			// The ranks are only known once every row has been counted
+			vector<size_t> ranks = OrderStatisticRanks(result.rows);
+			remaining.assign(ranks.begin(), ranks.end());
+			compute_queue.enqueueWriteBuffer(buffer_remaining, CL_FALSE, 0, nr_ranks * sizeof(cl_uint), &remaining[0]);
+		}
+
+		// Pick the bucket holding each rank once the histograms hold every chunk (the queue is in order)
+		kernel_events.push_back(cl::Event());
+		compute_queue.enqueueNDRangeKernel(narrow_kernel, cl::NullRange, cl::NDRange(nr_ranks), cl::NullRange, NULL, &kernel_events.back());
+		result.passes++;
+	}
+
+	if (sketch)
+	{
+		compute_queue.finish();
+	}
+	else
+	{
+		result.order_keys.assign(nr_ranks, 0);
+		read_events.push_back(cl::Event());
+		compute_queue.enqueueReadBuffer(buffer_prefix, CL_TRUE, 0, nr_ranks * sizeof(cl_uint), &result.order_keys[0], NULL, &read_events.back());
+	}
+
+	auto stream_end = chrono::high_resolution_clock::now();
+	result.wall_ns = chrono::duration_cast<chrono::nanoseconds>(stream_end - stream_start).count();
+
+	// Merge the statistics of every chunk (in file order)
+	result.stats = EmptyTotalStats();
+	for (const Stats& stats : chunk_stats)
+		result.stats = MergeTotalStats(result.stats, WidenStats(stats));
+
+	for (auto& event : upload_events)
+		result.upload_ns += EventDuration(event);
+	for (auto& event : kernel_events)
+		result.kernel_ns += EventDuration(event);
+	for (auto& event : read_events)
+		result.read_ns += EventDuration(event);
+	result.kernel_launches = kernel_events.size();
+}
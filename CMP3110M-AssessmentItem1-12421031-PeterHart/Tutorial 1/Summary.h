@@ -0,0 +1,156 @@
+/* Summary.h | Host side of the fused statistics and histogram kernels, shared by every mode which summarises a column */
+
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <CL/cl.hpp>
+#include "Statistics.h"
+#include "FixedPoint.h"
+
+using namespace std;
+
+// Kernels of the fused statistics (reduce_statistics then combine_statistics, or reduce_statistics_fixed over a
+// fixed-point column) and of the histogram, with their launch configuration on one device.
+// The local sizes must match any sizes baked into the program (see TuningBuildOptions).
+struct SummaryKernels {
+	bool fixed_point = false;
+	cl::Kernel reduce;
+	cl::Kernel combine;
+	cl::Kernel histogram;
+	size_t compute_groups = 1;		// enough workgroups to fill the device
+	size_t stats_local = 1;
+	size_t stats_items = 0;			// elements per work-item, or 0 for at most compute_groups workgroups
+	size_t combine_local = 1;
+	size_t histogram_local = 1;
+	size_t histogram_items = 0;
+};
+
+// Device buffers of one summary: partial statistics of every workgroup, combined statistics and histogram bins
+struct SummaryBuffers {
+	cl::Buffer partials;
+	cl::Buffer stats;
+	cl::Buffer histogram;
+};
+
+// Number of workgroups giving every work-item about items elements
+size_t TunedGroups(size_t rows, size_t local_size, size_t items) {
+	return max((size_t)1, (rows + local_size * items - 1) / (local_size * items));
+}
+
+// Number of workgroups of a strided kernel: every work-item strides over several elements, so only enough
+// workgroups to fill the device (or the number following from the elements per work-item, when tuned)
+size_t SummaryGroups(size_t rows, size_t local_size, size_t items, size_t compute_groups) {
+	if (items)
+		return TunedGroups(rows, local_size, items);
+	return max((size_t)1, min((rows + local_size - 1) / local_size, compute_groups));
+}
+
+// Kernels of a program, with the largest workgroups they allow on the device (up to 256)
+SummaryKernels CreateSummaryKernels(const cl::Program& program, const cl::Device& device, bool fixed_point = false) {
+	SummaryKernels kernels;
+	kernels.fixed_point = fixed_point;
+	kernels.reduce = cl::Kernel(program, fixed_point ? "reduce_statistics_fixed" : "reduce_statistics");
+	kernels.combine = cl::Kernel(program, "combine_statistics");
+	kernels.histogram = cl::Kernel(program, fixed_point ? "histogram_fixed" : "histogram");
+
+	kernels.compute_groups = (size_t)device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>() * 4;
+	kernels.stats_local = min((size_t)256, kernels.reduce.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device));
+	kernels.combine_local = min((size_t)256, kernels.combine.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device));
+	kernels.histogram_local = min((size_t)256, kernels.histogram.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device));
+	return kernels;
+}
+
+// Buffers for the summaries of up to rows elements (a buffer set may be reused once its previous commands are done),
+// without the bins when only the statistics are enqueued
+SummaryBuffers CreateSummaryBuffers(const cl::Context& context, const SummaryKernels& kernels, size_t rows, bool histogram = true) {
+	SummaryBuffers buffers;
+	size_t groups = SummaryGroups(rows, kernels.stats_local, kernels.stats_items, kernels.compute_groups);
+	buffers.partials = cl::Buffer(context, CL_MEM_READ_WRITE, groups * sizeof(Stats));
+	buffers.stats = cl::Buffer(context, CL_MEM_READ_WRITE, kernels.fixed_point ? sizeof(FixedStats) : sizeof(Stats));
+	if (histogram)
+		buffers.histogram = cl::Buffer(context, CL_MEM_READ_WRITE, HISTOGRAM_BINS * sizeof(cl_uint));
+	return buffers;
+}
+
+// Enqueue the fused statistics of the first rows elements of buffer_A once the events in wait complete, and the
+// read of the result into stats (non-blocking). Each workgroup is reduced, then the workgroups are combined
+// (instead of atomics serialising every workgroup on one element). The kernels are appended to kernel_events.
+void EnqueueStatistics(const cl::CommandQueue& queue, SummaryKernels& kernels, const cl::Buffer& buffer_A, size_t rows, const SummaryBuffers& buffers,
+	const vector<cl::Event>& wait, Stats& stats, vector<cl::Event>& kernel_events, cl::Event& read_event) {
+	size_t groups = SummaryGroups(rows, kernels.stats_local, kernels.stats_items, kernels.compute_groups);
+
+	kernels.reduce.setArg(0, buffer_A);
+	kernels.reduce.setArg(1, buffers.partials);
+	kernels.reduce.setArg(2, cl::Local(kernels.stats_local * sizeof(Stats)));
+	kernels.reduce.setArg(3, (cl_int)rows);		// number of elements, so any padding is never read
+
+	kernels.combine.setArg(0, buffers.partials);
+	kernels.combine.setArg(1, buffers.stats);
+	kernels.combine.setArg(2, cl::Local(kernels.combine_local * sizeof(Stats)));
+	kernels.combine.setArg(3, (cl_int)groups);
+
+	kernel_events.push_back(cl::Event());
+	queue.enqueueNDRangeKernel(kernels.reduce, cl::NullRange, cl::NDRange(groups * kernels.stats_local), cl::NDRange(kernels.stats_local), &wait, &kernel_events.back());
+	vector<cl::Event> reduced = { kernel_events.back() };
+	kernel_events.push_back(cl::Event());
+	queue.enqueueNDRangeKernel(kernels.combine, cl::NullRange, cl::NDRange(kernels.combine_local), cl::NDRange(kernels.combine_local), &reduced, &kernel_events.back());
+
+	vector<cl::Event> combined = { kernel_events.back() };
+	queue.enqueueReadBuffer(buffers.stats, CL_FALSE, 0, sizeof(Stats), &stats, &combined, &read_event);
+}
+
+// Same, over a fixed-point column: exact integer sums of the tenths, merged into one accumulator (cleared first,
+// from stats) by the native atomics of every workgroup
+void EnqueueStatistics(const cl::CommandQueue& queue, SummaryKernels& kernels, const cl::Buffer& buffer_A, size_t rows, const SummaryBuffers& buffers,
+	const vector<cl::Event>& wait, FixedStats& stats, vector<cl::Event>& kernel_events, cl::Event& clear_event, cl::Event& read_event) {
+	size_t groups = SummaryGroups(rows, kernels.stats_local, kernels.stats_items, kernels.compute_groups);
+
+	kernels.reduce.setArg(0, buffer_A);
+	kernels.reduce.setArg(1, buffers.stats);
+	kernels.reduce.setArg(2, cl::Local(kernels.stats_local * sizeof(FixedPartial)));
+	kernels.reduce.setArg(3, (cl_int)rows);
+
+	stats = EmptyFixedStats();
+	queue.enqueueWriteBuffer(buffers.stats, CL_FALSE, 0, sizeof(FixedStats), &stats, NULL, &clear_event);
+	vector<cl::Event> ready = wait;
+	ready.push_back(clear_event);
+
+	kernel_events.push_back(cl::Event());
+	queue.enqueueNDRangeKernel(kernels.reduce, cl::NullRange, cl::NDRange(groups * kernels.stats_local), cl::NDRange(kernels.stats_local), &ready, &kernel_events.back());
+	vector<cl::Event> reduced = { kernel_events.back() };
+	queue.enqueueReadBuffer(buffers.stats, CL_FALSE, 0, sizeof(FixedStats), &stats, &reduced, &read_event);
+}
+
+// Enqueue the clear of the bins, the histogram (0.1 degree bins) of the first rows elements of buffer_A once the
+// events in wait and the clear complete, and the read of the HISTOGRAM_BINS counts into histogram (non-blocking)
+void EnqueueHistogram(const cl::CommandQueue& queue, SummaryKernels& kernels, const cl::Buffer& buffer_A, size_t rows, const SummaryBuffers& buffers,
+	const vector<cl::Event>& wait, cl_uint* histogram, cl::Event& clear_event, cl::Event& kernel_event, cl::Event& read_event) {
+	size_t groups = SummaryGroups(rows, kernels.histogram_local, kernels.histogram_items, kernels.compute_groups);
+	size_t histogram_size = HISTOGRAM_BINS * sizeof(cl_uint);
+
+	kernels.histogram.setArg(0, buffer_A);
+	kernels.histogram.setArg(1, buffers.histogram);
+	kernels.histogram.setArg(2, cl::Local(histogram_size));	// private bins of each workgroup
+	kernels.histogram.setArg(3, (cl_int)rows);
+	kernels.histogram.setArg(4, (cl_int)HISTOGRAM_BINS);
+	if (kernels.fixed_point)
+	{
+		// The bins are exactly one tenth wide, so only the first bin is needed
+		kernels.histogram.setArg(5, FIXED_HISTOGRAM_MIN);
+	}
+	else
+	{
+		kernels.histogram.setArg(5, HISTOGRAM_MIN);
+		kernels.histogram.setArg(6, HISTOGRAM_RESOLUTION);
+	}
+
+	queue.enqueueFillBuffer(buffers.histogram, (cl_uint)0, 0, histogram_size, NULL, &clear_event);
+	vector<cl::Event> ready = wait;
+	ready.push_back(clear_event);
+	queue.enqueueNDRangeKernel(kernels.histogram, cl::NullRange, cl::NDRange(groups * kernels.histogram_local), cl::NDRange(kernels.histogram_local), &ready, &kernel_event);
+
+	// Only the bins cross the bus
+	vector<cl::Event> counted = { kernel_event };
+	queue.enqueueReadBuffer(buffers.histogram, CL_FALSE, 0, histogram_size, histogram, &counted, &read_event);
+}
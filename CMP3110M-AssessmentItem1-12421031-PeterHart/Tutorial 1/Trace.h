@@ -0,0 +1,142 @@
+/* Trace.h | Timeline of every traced OpenCL command and host phase, exported as Chrome trace-event JSON (Perfetto, chrome://tracing) */
+
+#pragma once
+
+#include <fstream>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <algorithm>
+#include <CL/cl.hpp>
+
+using namespace std;
+
+typedef chrono::high_resolution_clock::time_point TraceTime;
+
+// One enqueued command, resolved through its profiling info when the trace is written
+struct TracedCommand {
+	cl::Event event;
+	string name;
+};
+
+// One span of host work (parsing, program build, waiting, ...)
+struct TracedPhase {
+	string name;
+	TraceTime start;
+	TraceTime end;
+};
+
+// Every command and phase of a run. Nothing is recorded unless enabled, so tracing costs nothing by default.
+struct Trace {
+	bool enabled = false;
+	TraceTime origin = chrono::high_resolution_clock::now();
+
+	// Host time at which the first traced command was enqueued: the device clock has its own origin, so the
+	// earliest queued timestamp of the commands is pinned to this time
+	TraceTime device_anchor;
+	bool has_anchor = false;
+
+	vector<TracedCommand> commands;
+	vector<TracedPhase> phases;
+};
+
+// Record an enqueued command (the event must come from a queue with profiling enabled)
+void TraceCommand(Trace& trace, const cl::Event& event, const string& name) {
+	if (!trace.enabled)
+		return;
+	TracedCommand command = { event, name };
+	trace.commands.push_back(command);
+}
+
+// Record every event of a list under the same name
+void TraceCommands(Trace& trace, const vector<cl::Event>& events, const string& name) {
+	for (const cl::Event& event : events)
+		TraceCommand(trace, event, name);
+}
+
+// Record a span of host work
+void TracePhase(Trace& trace, const string& name, TraceTime start, TraceTime end) {
+	if (!trace.enabled)
+		return;
+	TracedPhase phase = { name, start, end };
+	trace.phases.push_back(phase);
+}
+
+// Set the host time of the first enqueue, which aligns the device timeline with the host one
+void TraceDeviceAnchor(Trace& trace, TraceTime anchor) {
+	trace.device_anchor = anchor;
+	trace.has_anchor = true;
+}
+
+// Name of the timeline row of a command: kernels and transfers get separate rows, so that the
+// overlap of the two on an out-of-order queue is visible
+string TraceTrack(const cl::Event& event) {
+	cl_command_type type = event.getInfo<CL_EVENT_COMMAND_TYPE>();
+	return (type == CL_COMMAND_NDRANGE_KERNEL || type == CL_COMMAND_TASK) ? "Kernels" : "Transfers";
+}
+
+// Quote a string for JSON
+string TraceQuote(const string& text) {
+	string quoted = "\"";
+	for (char c : text)
+	{
+		if (c == '"' || c == '\\')
+			quoted += '\\';
+		quoted += c;
+	}
+	return quoted + "\"";
+}
+
+// Write the trace as Chrome trace-event JSON: one complete ("X") event per command and phase, in microseconds
+// since the start of the run. The host phases and the device commands are two processes of the timeline.
+// Every recorded command must be complete. Returns false if the file cannot be written.
+bool WriteChromeTrace(const Trace& trace, const string& file_name) {
+	ofstream file(file_name);
+	if (!file)
+		return false;
+
+	file << fixed;
+	file.precision(3);
+
+	file << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[" << endl;
+	file << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"Host\"}}," << endl;
+	file << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":2,\"tid\":0,\"args\":{\"name\":\"Device\"}}," << endl;
+	file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"Main thread\"}}," << endl;
+	file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":2,\"tid\":1,\"args\":{\"name\":\"Transfers\"}}," << endl;
+	file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":2,\"tid\":2,\"args\":{\"name\":\"Kernels\"}}";
+
+	for (const TracedPhase& phase : trace.phases)
+	{
+		double ts = chrono::duration_cast<chrono::nanoseconds>(phase.start - trace.origin).count() * 1e-3;
+		double dur = chrono::duration_cast<chrono::nanoseconds>(phase.end - phase.start).count() * 1e-3;
+		file << "," << endl << "{\"name\":" << TraceQuote(phase.name) << ",\"cat\":\"host\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":" << ts << ",\"dur\":" << dur << "}";
+	}
+
+	if (!trace.commands.empty())
+	{
+		// Device timestamps of the earliest command, and the host time it maps to
+		cl_ulong device_origin = trace.commands[0].event.getProfilingInfo<CL_PROFILING_COMMAND_QUEUED>();
+		for (const TracedCommand& command : trace.commands)
+			device_origin = min(device_origin, command.event.getProfilingInfo<CL_PROFILING_COMMAND_QUEUED>());
+		TraceTime anchor = trace.has_anchor ? trace.device_anchor : trace.origin;
+		double anchor_us = chrono::duration_cast<chrono::nanoseconds>(anchor - trace.origin).count() * 1e-3;
+
+		for (const TracedCommand& command : trace.commands)
+		{
+			cl_ulong queued = command.event.getProfilingInfo<CL_PROFILING_COMMAND_QUEUED>();
+			cl_ulong start = command.event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+			cl_ulong end = command.event.getProfilingInfo<CL_PROFILING_COMMAND_END>();
+			string track = TraceTrack(command.event);
+
+			double ts = anchor_us + (start - device_origin) * 1e-3;
+			double dur = (end - start) * 1e-3;
+			file << "," << endl << "{\"name\":" << TraceQuote(command.name) << ",\"cat\":\"" << (track == "Kernels" ? "kernel" : "transfer")
+				<< "\",\"ph\":\"X\",\"pid\":2,\"tid\":" << (track == "Kernels" ? 2 : 1) << ",\"ts\":" << ts << ",\"dur\":" << dur
+				<< ",\"args\":{\"queued_to_start_us\":" << (start - queued) * 1e-3 << "}}";
+		}
+	}
+
+	file << endl << "]}" << endl;
+	file.close();
+	return !file.fail();
+}
@@ -221,4 +221,46 @@ string GetFullProfilingInfo(const cl::Event& evnt, ProfilingResolution resolutio
 	}
 
 	return sstream.str();
-}
\ No newline at end of file
+}
+
+// Profiling info summed over several events (e.g. a sort made of several kernel launches)
+string GetFullProfilingInfo(const vector<cl::Event>& events, ProfilingResolution resolution) {
+	stringstream sstream;
+	cl_ulong queued = 0, submitted = 0, executed = 0, total = 0;
+
+	for (const cl::Event& evnt : events)
+	{
+		queued += evnt.getProfilingInfo<CL_PROFILING_COMMAND_SUBMIT>() - evnt.getProfilingInfo<CL_PROFILING_COMMAND_QUEUED>();
+		submitted += evnt.getProfilingInfo<CL_PROFILING_COMMAND_START>() - evnt.getProfilingInfo<CL_PROFILING_COMMAND_SUBMIT>();
+		executed += evnt.getProfilingInfo<CL_PROFILING_COMMAND_END>() - evnt.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+		total += evnt.getProfilingInfo<CL_PROFILING_COMMAND_END>() - evnt.getProfilingInfo<CL_PROFILING_COMMAND_QUEUED>();
+	}
+
+	sstream << "Queued " << queued / resolution;
+	sstream << ", Submitted " << submitted / resolution;
+	sstream << ", Executed " << executed / resolution;
+	sstream << ", Total " << total / resolution;
+
+	switch (resolution) {
+	case PROF_NS: sstream << " [ns]"; break;
+	case PROF_US: sstream << " [us]"; break;
+	case PROF_MS: sstream << " [ms]"; break;
+	case PROF_S: sstream << " [s]"; break;
+	default: break;
+	}
+
+	return sstream.str();
+}
+
+// Time from the start of the earliest command to the end of the latest command in a set of events
+cl_ulong GetProfilingSpan(const vector<cl::Event>& events) {
+	cl_ulong first = ~(cl_ulong)0, last = 0;
+
+	for (const cl::Event& evnt : events)
+	{
+		first = min(first, evnt.getProfilingInfo<CL_PROFILING_COMMAND_START>());
+		last = max(last, evnt.getProfilingInfo<CL_PROFILING_COMMAND_END>());
+	}
+
+	return (last > first) ? last - first : 0;
+}
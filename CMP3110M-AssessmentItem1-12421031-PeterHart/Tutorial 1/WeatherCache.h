@@ -0,0 +1,208 @@
+/* WeatherCache.h | Binary columnar cache of a weather data file, so repeat runs skip text parsing */
+
+#pragma once
+
+#include <fstream>
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstdint>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "DataLoader.h"
+
+using namespace std;
+
+// Layout of a cache file:
+//   header | station dictionary (length-prefixed names) | station id column (uint16)
+//   | packed date/time column (uint32) | air temperature column (float)
+// Every column starts on a 64-byte boundary so that it can be used straight from the mapping.
+const char WEATHER_CACHE_MAGIC[8] = { 'W', 'X', 'C', 'O', 'L', 'S', '\0', '\0' };
+const uint32_t WEATHER_CACHE_VERSION = 1;
+const uint64_t WEATHER_CACHE_ALIGN = 64;
+
+struct WeatherCacheHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t stations;
+	uint64_t rows;
+	uint64_t source_size;
+	int64_t source_mtime;
+	uint64_t dictionary_offset;
+	uint64_t station_offset;
+	uint64_t date_time_offset;
+	uint64_t temperature_offset;
+	uint64_t file_size;
+};
+
+// The cache lives next to the text file it was built from
+string GetCacheFileName(const string& file_name) {
+	return file_name + ".cache";
+}
+
+// Size and modification time of a file, used to detect a stale cache
+bool GetFileStamp(const string& file_name, uint64_t& size, int64_t& mtime) {
+#ifdef _WIN32
+	struct _stat64 file_info;
+	if (_stat64(file_name.c_str(), &file_info) != 0)
+		return false;
+#else
+	struct stat file_info;
+	if (stat(file_name.c_str(), &file_info) != 0)
+		return false;
+#endif
+	size = (uint64_t)file_info.st_size;
+	mtime = (int64_t)file_info.st_mtime;
+	return true;
+}
+
+inline uint64_t AlignCacheOffset(uint64_t offset) {
+	return (offset + WEATHER_CACHE_ALIGN - 1) / WEATHER_CACHE_ALIGN * WEATHER_CACHE_ALIGN;
+}
+
+// True if count elements of element_size bytes from offset lie within a file of file_size bytes (without overflowing)
+inline bool CacheSpanFits(uint64_t offset, uint64_t count, uint64_t element_size, uint64_t file_size) {
+	return offset <= file_size && count <= (file_size - offset) / element_size;
+}
+
+// Write the columns of a freshly parsed file to its cache. Returns false if the cache cannot be written.
+bool SaveWeatherCache(const string& file_name, const WeatherData& data) {
+	WeatherCacheHeader header = {};
+	memcpy(header.magic, WEATHER_CACHE_MAGIC, sizeof(header.magic));
+	header.version = WEATHER_CACHE_VERSION;
+	header.rows = data.rows;
+
+	if (!GetFileStamp(file_name, header.source_size, header.source_mtime))
+		return false;
+
+	const vector<string>& dictionary = data.stations;
+	header.stations = (uint32_t)dictionary.size();
+
+	// Work out where each section starts
+	uint64_t dictionary_size = 0;
+	for (const string& name : dictionary)
+		dictionary_size += sizeof(uint32_t) + name.size();
+
+	header.dictionary_offset = AlignCacheOffset(sizeof(header));
+	header.station_offset = AlignCacheOffset(header.dictionary_offset + dictionary_size);
+	header.date_time_offset = AlignCacheOffset(header.station_offset + data.rows * sizeof(uint16_t));
+	header.temperature_offset = AlignCacheOffset(header.date_time_offset + data.rows * sizeof(uint32_t));
+	header.file_size = header.temperature_offset + data.rows * sizeof(float);
+
+	// Write to a temporary file first, so that an interrupted run never leaves a truncated cache behind
+	string cache_name = GetCacheFileName(file_name);
+	string temp_name = cache_name + ".tmp";
+	ofstream cache(temp_name, ios::binary | ios::trunc);
+	if (!cache)
+		return false;
+
+	const char zeros[WEATHER_CACHE_ALIGN] = {};
+	auto pad_to = [&](uint64_t offset) { cache.write(zeros, (streamsize)(offset - (uint64_t)cache.tellp())); };
+
+	cache.write((const char*)&header, sizeof(header));
+
+	pad_to(header.dictionary_offset);
+	for (const string& name : dictionary)
+	{
+		uint32_t length = (uint32_t)name.size();
+		cache.write((const char*)&length, sizeof(length));
+		cache.write(name.data(), length);
+	}
+
+	pad_to(header.station_offset);
+	cache.write((const char*)data.stationId, data.rows * sizeof(uint16_t));
+	pad_to(header.date_time_offset);
+	cache.write((const char*)data.dateTime, data.rows * sizeof(uint32_t));
+	pad_to(header.temperature_offset);
+	cache.write((const char*)data.temperature, data.rows * sizeof(float));
+
+	cache.close();
+	if (!cache)
+	{
+		remove(temp_name.c_str());
+		return false;
+	}
+
+	remove(cache_name.c_str());
+	return rename(temp_name.c_str(), cache_name.c_str()) == 0;
+}
+
+// Memory-map the cache of a text file. Every column is used in place, straight from the mapping.
+// Returns false if there is no cache, or if it does not match the current size and mtime of the text file.
+bool LoadWeatherCache(const string& file_name, WeatherData& data) {
+	uint64_t source_size;
+	int64_t source_mtime;
+
+	if (!GetFileStamp(file_name, source_size, source_mtime))
+		return false;
+
+	MappedFile mapped;
+	if (!MapFile(mapped, GetCacheFileName(file_name)) || mapped.size < sizeof(WeatherCacheHeader))
+	{
+		UnmapFile(mapped);
+		return false;
+	}
+
+	WeatherCacheHeader header;
+	memcpy(&header, mapped.data, sizeof(header));
+
+	// Reject caches written by another version, for another file or for an older copy of this one
+	if (memcmp(header.magic, WEATHER_CACHE_MAGIC, sizeof(header.magic)) != 0 ||
+		header.version != WEATHER_CACHE_VERSION ||
+		header.file_size != mapped.size ||
+		header.source_size != source_size ||
+		header.source_mtime != source_mtime)
+	{
+		UnmapFile(mapped);
+		return false;
+	}
+
+	// Reject a truncated or corrupted cache whose columns would not lie (aligned) within the mapping
+	if (!CacheSpanFits(header.station_offset, header.rows, sizeof(uint16_t), mapped.size) ||
+		!CacheSpanFits(header.date_time_offset, header.rows, sizeof(uint32_t), mapped.size) ||
+		!CacheSpanFits(header.temperature_offset, header.rows, sizeof(float), mapped.size) ||
+		!CacheSpanFits(header.dictionary_offset, header.stations, sizeof(uint32_t), header.station_offset) ||
+		header.station_offset % WEATHER_CACHE_ALIGN || header.date_time_offset % WEATHER_CACHE_ALIGN || header.temperature_offset % WEATHER_CACHE_ALIGN)
+	{
+		UnmapFile(mapped);
+		return false;
+	}
+
+	// Read the station dictionary, checking every name against the end of the dictionary
+	vector<string> stations(header.stations);
+	uint64_t offset = header.dictionary_offset;
+	for (uint32_t i = 0; i < header.stations; i++)
+	{
+		uint32_t length;
+		if (!CacheSpanFits(offset, sizeof(length), 1, header.station_offset))
+		{
+			UnmapFile(mapped);
+			return false;
+		}
+		memcpy(&length, mapped.data + offset, sizeof(length));
+		offset += sizeof(length);
+
+		if (!CacheSpanFits(offset, length, 1, header.station_offset))
+		{
+			UnmapFile(mapped);
+			return false;
+		}
+		stations[i].assign(mapped.data + offset, length);
+		offset += length;
+	}
+	data.stations.swap(stations);
+
+	// Every column is used in place, straight from the mapping (no decoding at all)
+	data.rows = (size_t)header.rows;
+	data.stationIdColumn.clear();
+	data.dateTimeColumn.clear();
+	data.airTemp.clear();
+
+	UnmapFile(data.cache);
+	data.cache = mapped;
+	data.stationId = (const uint16_t*)(mapped.data + header.station_offset);
+	data.dateTime = (const uint32_t*)(mapped.data + header.date_time_offset);
+	data.temperature = (const float*)(mapped.data + header.temperature_offset);
+
+	return true;
+}
@@ -0,0 +1,46 @@
+/* ZeroCopy.h | Zero-copy device buffers over host memory, for the devices which share it (CPU and integrated GPU devices) */
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <CL/cl.hpp>
+#include "DataLoader.h"
+
+using namespace std;
+
+// True if the device works in host memory, so a buffer in host memory is used in place instead of copied
+bool SharesHostMemory(const cl::Device& device) {
+	return device.getInfo<CL_DEVICE_TYPE>() == CL_DEVICE_TYPE_CPU || device.getInfo<CL_DEVICE_HOST_UNIFIED_MEMORY>() == CL_TRUE;
+}
+
+inline bool IsPageAligned(const void* p) {
+	return ((uintptr_t)p % COLUMN_PAGE_SIZE) == 0;
+}
+
+// Create a read-only buffer of buffer_size bytes holding the data_size bytes of a host column, without a transfer.
+// A page-aligned column with room for the whole buffer (host_capacity bytes, see PageAllocationSize) becomes the
+// storage of the buffer (CL_MEM_USE_HOST_PTR), and a marker stands in for the upload. Any other column (e.g. straight
+// from a read-only cache mapping) is written through a map of a buffer allocated in host memory (CL_MEM_ALLOC_HOST_PTR),
+// so the only copy is the one on the host, and the unmap is the upload. Either way, upload_event completes once the
+// device can read the buffer.
+cl::Buffer CreateZeroCopyBuffer(const cl::Context& context, cl::CommandQueue& queue, const void* host, size_t data_size, size_t buffer_size, size_t host_capacity, cl::Event& upload_event) {
+	if (IsPageAligned(host) && host_capacity >= buffer_size)
+	{
+		cl::Buffer buffer(context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, buffer_size, (void*)host);
+		queue.enqueueMarkerWithWaitList(NULL, &upload_event);
+		return buffer;
+	}
+
+	cl::Buffer buffer(context, CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR, buffer_size);
+	void* mapped = queue.enqueueMapBuffer(buffer, CL_TRUE, CL_MAP_WRITE_INVALIDATE_REGION, 0, data_size);
+	memcpy(mapped, host, data_size);
+	queue.enqueueUnmapMemObject(buffer, mapped, NULL, &upload_event);
+	return buffer;
+}
+
+// Bytes of host memory behind a column of the loader (0 when the column is not one of its page-aligned vectors)
+template<typename T>
+size_t ColumnCapacity(const PageVector<T>& column, const void* in_use) {
+	return (!column.empty() && column.data() == in_use) ? PageAllocationSize(column.capacity() * sizeof(T)) : 0;
+}
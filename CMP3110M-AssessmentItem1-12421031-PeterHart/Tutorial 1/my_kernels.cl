@@ -1,89 +1,207 @@
 /*my_kernels.cl*/
 
-void atomicAdd(__global float*, float);
+// Mergeable statistics of a set of values (count, mean, sum of squared differences from the mean, min and max)
+// Must match the layout of the Stats struct on the host
+typedef struct {
+	uint count;
+	float mean;
+	float m2;
+	float min;
+	float max;
+} Stats;
+
+// Add one value to a set of statistics (Welford's update)
+Stats stats_add(Stats a, float value)
+{
+	a.count += 1;
+	float delta = value - a.mean;
+	a.mean += delta / a.count;
+	a.m2 += delta * (value - a.mean);
+	a.min = fmin(a.min, value);
+	a.max = fmax(a.max, value);
+	return a;
+}
 
-// Addition through reduction
-__kernel void reduce_add(__global const float* A, __global float* B, __local float* scratch, float pad) {
-	int id = get_global_id(0);
+// Merge two sets of statistics (Chan et al. parallel update)
+Stats stats_merge(Stats a, Stats b)
+{
+	if (b.count == 0) return a;
+	if (a.count == 0) return b;
+
+	float count = (float)a.count + (float)b.count;
+	float delta = b.mean - a.mean;
+
+	Stats result;
+	result.count = a.count + b.count;
+	result.mean = a.mean + delta * ((float)b.count / count);
+	result.m2 = a.m2 + b.m2 + delta * delta * ((float)a.count * (float)b.count / count);
+	result.min = fmin(a.min, b.min);
+	result.max = fmax(a.max, b.max);
+	return result;
+}
+
+Stats stats_empty()
+{
+	Stats empty = { 0, 0.f, 0.f, INFINITY, -INFINITY };
+	return empty;
+}
+
+// Workgroup size of the fused statistics, when tuned for the device (see Autotune.h): baked in as a build option,
+// so that the merge loop unrolls at compile time. Otherwise the kernel takes the size it is launched with.
+#ifdef STATS_LOCAL
+#define STATS_N STATS_LOCAL
+#define STATS_ATTRIBUTES __attribute__((reqd_work_group_size(STATS_LOCAL, 1, 1)))
+#else
+#define STATS_N get_local_size(0)
+#define STATS_ATTRIBUTES
+#endif
+
+// Fused statistics through reduction
+// Reads every element exactly once: each work-item accumulates a strided subset of the data, then the workgroup
+// merges its partial statistics in local memory and writes one set of statistics per workgroup (no atomics).
+__kernel STATS_ATTRIBUTES void reduce_statistics(__global const float* A, __global Stats* B, __local Stats* scratch, int n)
+{
 	int lid = get_local_id(0);
-	int N = get_local_size(0);
+	int N = STATS_N;
 
-	// Skip any neutral elements (pad) added for padding
-	if (A[id] != pad)
-	{
-		// Cache all N elements from global memory to local memory
-		scratch[lid] = A[id];
-	}
+	// Accumulate the elements of this work-item
+	Stats partial = stats_empty();
+	for (int i = get_global_id(0); i < n; i += get_global_size(0))
+		partial = stats_add(partial, A[i]);
 
-	// Wait for all local threads to finish copying from global to local memory
+	scratch[lid] = partial;
+
+	// Wait for all local threads to finish accumulating
 	barrier(CLK_LOCAL_MEM_FENCE);
 
-	// Step through the data and accumulate partial sums in each workgroup
-	for (int i = 1; i < N; i *= 2) {
+	// Step through the partial statistics and merge them in each workgroup
+	for (int i = 1; i < N; i *= 2)
+	{
 		// Stride through the vector
 		if (!(lid % (i * 2)) && ((lid + i) < N))
 		{
-			// Calculate partial sum
-			scratch[lid] += scratch[lid + i];
+			scratch[lid] = stats_merge(scratch[lid], scratch[lid + i]);
 		}
-		// Wait for all local threads to finish partial sum accumulation
+		// Wait for all local threads to finish merging
 		barrier(CLK_LOCAL_MEM_FENCE);
 	}
 
-
-	// Copy the cache to the output vector
-	if (!lid) 
+	// Copy the statistics of this workgroup to the output vector
+	if (!lid)
 	{
-		// Accumulate the total of the partial sums (from each local workgroup) to the first element of the output vector
-		// (serial operation)
-		atomicAdd(&B[0], scratch[lid]);
+		B[get_group_id(0)] = scratch[0];
 	}
 }
 
-// Standard Deviation through reduction
-__kernel void reduce_standard_deviation(__global const float* A, __global float* B, __local float* scratch, float mean, float pad) 
+// Final combine step of the fused statistics
+// Run as a single workgroup, which merges the statistics of every workgroup of reduce_statistics into B[0]
+__kernel void combine_statistics(__global const Stats* A, __global Stats* B, __local Stats* scratch, int groups)
 {
-	int id = get_global_id(0);
 	int lid = get_local_id(0);
 	int N = get_local_size(0);
 
-	// Cache all N values from global memory to local memory
-	scratch[lid] = A[id];
+	// Merge a strided subset of the partial statistics
+	Stats partial = stats_empty();
+	for (int i = lid; i < groups; i += N)
+		partial = stats_merge(partial, A[i]);
 
-	// Wait for all local threads to finish copying from global to local memory
+	scratch[lid] = partial;
+
+	// Wait for all local threads to finish merging
 	barrier(CLK_LOCAL_MEM_FENCE);
 
-	if (scratch[lid] != pad)
-	{ 
-		// Calculate the squared difference of each element from the mean
-		scratch[lid] = ((scratch[lid] - mean) * (scratch[lid] - mean));
+	// Step through the partial statistics and merge them
+	for (int i = 1; i < N; i *= 2)
+	{
+		if (!(lid % (i * 2)) && ((lid + i) < N))
+		{
+			scratch[lid] = stats_merge(scratch[lid], scratch[lid + i]);
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+
+	if (!lid)
+	{
+		B[0] = scratch[0];
 	}
-	else
+}
+
+// Exact statistics of a column stored as 16-bit tenths of a degree (see FixedStats on the host)
+// The 64-bit sums are held as two 32-bit halves, so that only the core 32-bit atomics are needed
+typedef struct {
+	uint count;
+	int min;
+	int max;
+	uint sum_lo;
+	uint sum_hi;
+	uint squares_lo;
+	uint squares_hi;
+} FixedStats;
+
+// Partial statistics of one work-item
+typedef struct {
+	long sum;
+	long squares;
+	uint count;
+	int min;
+	int max;
+} FixedPartial;
+
+// Add a 64-bit value to a sum held as two 32-bit halves (the carry out of the low half goes into the high half)
+void atomic_add_wide(volatile __global uint* lo, volatile __global uint* hi, long value)
+{
+	uint low = (uint)value;
+	uint old = atomic_add(lo, low);
+	atomic_add(hi, (uint)((ulong)value >> 32) + ((uint)(old + low) < old ? 1 : 0));
+}
+
+// Fused statistics of a fixed-point column in a single launch
+// Same access pattern as reduce_statistics, but every work-item accumulates exact integer sums and each workgroup
+// merges its partials straight into S with native atomics, so no combine step is needed (S must start as EmptyFixedStats)
+__kernel void reduce_statistics_fixed(__global const short* A, __global FixedStats* S, __local FixedPartial* scratch, int n)
+{
+	int lid = get_local_id(0);
+	int N = get_local_size(0);
+
+	// Accumulate the elements of this work-item
+	FixedPartial partial = { 0, 0, 0, INT_MAX, INT_MIN };
+	for (int i = get_global_id(0); i < n; i += get_global_size(0))
 	{
-		scratch[lid] = pad;
-	} 
-	// Step through the data and accumulate partial sums in each workgroup
+		int value = A[i];
+		partial.count += 1;
+		partial.sum += value;
+		partial.squares += value * value;
+		partial.min = min(partial.min, value);
+		partial.max = max(partial.max, value);
+	}
+
+	scratch[lid] = partial;
+
+	// Wait for all local threads to finish accumulating
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	// Step through the partial statistics and merge them in each workgroup
 	for (int i = 1; i < N; i *= 2)
 	{
-		// Stride through the vector
 		if (!(lid % (i * 2)) && ((lid + i) < N))
 		{
-			if (scratch[lid + i] != pad)
-			{ 
-				// Calculate partial sum of the squared differences
-				scratch[lid] += scratch[lid + i];
-			}
+			scratch[lid].sum += scratch[lid + i].sum;
+			scratch[lid].squares += scratch[lid + i].squares;
+			scratch[lid].count += scratch[lid + i].count;
+			scratch[lid].min = min(scratch[lid].min, scratch[lid + i].min);
+			scratch[lid].max = max(scratch[lid].max, scratch[lid + i].max);
 		}
-		// Wait for all local threads to finish partial sum accumulation
 		barrier(CLK_LOCAL_MEM_FENCE);
 	}
 
-	// Copy the cache to the output vector
-	if (!lid)
+	// One set of atomics per workgroup
+	if (!lid && scratch[0].count)
 	{
-		// Accumulate the total of the partial sums (from each local workgroup) to the first element of the output vector
-		// (serial operation)
-		atomicAdd(&B[0], scratch[lid]);
+		atomic_add(&S->count, scratch[0].count);
+		atomic_min(&S->min, scratch[0].min);
+		atomic_max(&S->max, scratch[0].max);
+		atomic_add_wide(&S->sum_lo, &S->sum_hi, scratch[0].sum);
+		atomic_add_wide(&S->squares_lo, &S->squares_hi, scratch[0].squares);
 	}
 }
 
@@ -115,104 +233,652 @@ __kernel void parallel_selection_sort(__global const float* A, __global float* B
 	B[pos] = currentData;
 }
 
-// (Atomic) Max
-__kernel void reduce_max(__global const int* A, __global int* B, __local int* scratch, float pad)
+// Element type of the bitonic sort kernels (the group-by mode builds the program again with -D SORT_T=ulong,
+// the fixed-point storage with -D SORT_T=short)
+#ifndef SORT_T
+#define SORT_T float
+#endif
+
+// Workgroup size of the bitonic sort, when tuned for the device (same as STATS_LOCAL)
+#ifdef SORT_LOCAL
+#define SORT_N SORT_LOCAL
+#define SORT_ATTRIBUTES __attribute__((reqd_work_group_size(SORT_LOCAL, 1, 1)))
+#else
+#define SORT_N get_local_size(0)
+#define SORT_ATTRIBUTES
+#endif
+
+// Bitonic Sort (local stage)
+// Each work-item handles one pair of elements, so a workgroup of N work-items fully sorts a block of 2N elements
+// in local memory. Neighbouring blocks are sorted in opposite directions, ready to be merged by the global stages.
+__kernel SORT_ATTRIBUTES void bitonic_sort_local(__global SORT_T* A, __local SORT_T* scratch)
+{
+	int lid = get_local_id(0);
+	int N = SORT_N;
+	int block = get_group_id(0) * 2 * N;
+
+	// Cache the 2N elements of this block from global memory to local memory
+	scratch[lid] = A[block + lid];
+	scratch[lid + N] = A[block + lid + N];
+
+	// Wait for all local threads to finish copying from global to local memory
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (int k = 2; k <= 2 * N; k *= 2)
+	{
+		for (int j = k / 2; j > 0; j /= 2)
+		{
+			// Position of the first element of the pair compared by this work-item
+			int i = ((lid & ~(j - 1)) << 1) | (lid & (j - 1));
+
+			// The sort direction alternates every k elements (based on the global position)
+			bool ascending = ((block + i) & k) == 0;
+
+			SORT_T a = scratch[i];
+			SORT_T b = scratch[i + j];
+
+			// Swap the pair if it is out of order
+			if ((a > b) == ascending)
+			{
+				scratch[i] = b;
+				scratch[i + j] = a;
+			}
+
+			// Wait for all local threads to finish this step
+			barrier(CLK_LOCAL_MEM_FENCE);
+		}
+	}
+
+	// Copy the sorted block back to global memory
+	A[block + lid] = scratch[lid];
+	A[block + lid + N] = scratch[lid + N];
+}
+
+// Bitonic Sort (global merge step)
+// One compare-exchange step of distance j for bitonic sequences of length k, where the pairs span several workgroups
+__kernel void bitonic_merge_global(__global SORT_T* A, int k, int j)
 {
 	int id = get_global_id(0);
+
+	// Position of the first element of the pair compared by this work-item
+	int i = ((id & ~(j - 1)) << 1) | (id & (j - 1));
+	bool ascending = (i & k) == 0;
+
+	SORT_T a = A[i];
+	SORT_T b = A[i + j];
+
+	// Swap the pair if it is out of order
+	if ((a > b) == ascending)
+	{
+		A[i] = b;
+		A[i + j] = a;
+	}
+}
+
+// Bitonic Sort (local merge steps)
+// Once the compare distance fits within a block of 2N elements, all remaining steps of the merge run in local memory
+__kernel SORT_ATTRIBUTES void bitonic_merge_local(__global SORT_T* A, __local SORT_T* scratch, int k)
+{
+	int lid = get_local_id(0);
+	int N = SORT_N;
+	int block = get_group_id(0) * 2 * N;
+
+	// Cache the 2N elements of this block from global memory to local memory
+	scratch[lid] = A[block + lid];
+	scratch[lid + N] = A[block + lid + N];
+
+	// Wait for all local threads to finish copying from global to local memory
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	// The direction is the same for the whole block, since k is larger than the block
+	bool ascending = (block & k) == 0;
+
+	for (int j = N; j > 0; j /= 2)
+	{
+		// Position of the first element of the pair compared by this work-item
+		int i = ((lid & ~(j - 1)) << 1) | (lid & (j - 1));
+
+		SORT_T a = scratch[i];
+		SORT_T b = scratch[i + j];
+
+		// Swap the pair if it is out of order
+		if ((a > b) == ascending)
+		{
+			scratch[i] = b;
+			scratch[i + j] = a;
+		}
+
+		// Wait for all local threads to finish this step
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+
+	// Copy the merged block back to global memory
+	A[block + lid] = scratch[lid];
+	A[block + lid + N] = scratch[lid + N];
+}
+
+// Order-preserving mapping of a float onto an unsigned integer key (a < b if and only if key(a) < key(b))
+uint float_to_key(float value)
+{
+	uint bits = as_uint(value);
+	return (bits & 0x80000000) ? ~bits : (bits | 0x80000000);
+}
+
+// Inverse of float_to_key
+float key_to_float(uint key)
+{
+	return as_float((key & 0x80000000) ? (key & 0x7FFFFFFF) : ~key);
+}
+
+// Radix Select (histogram pass)
+// Finds order statistics without sorting: for every requested rank, count the next 8-bit digit of the keys that
+// share the digits already selected for that rank (prefix under mask). The host picks the bucket holding the rank
+// and narrows the prefix, so four passes give every rank exactly. Each work-item strides over several elements and
+// each workgroup keeps private histograms in local memory, merged into the global histograms with one atomic per bin.
+__kernel void radix_select_histogram(__global const float* A, __global uint* H, __global const uint* prefix, __local uint* scratch, int n, int ranks, uint mask, int shift)
+{
 	int lid = get_local_id(0);
 	int N = get_local_size(0);
+	int bins = ranks * 256;
+
+	// Clear the local histograms
+	for (int b = lid; b < bins; b += N)
+		scratch[b] = 0;
+
+	// Wait for all local threads to finish clearing local memory
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	// Count the digits of every element which still matches the prefix of each rank
+	for (int i = get_global_id(0); i < n; i += get_global_size(0))
+	{
+		uint key = float_to_key(A[i]);
+		uint digit = (key >> shift) & 0xFF;
 
-	// Skip any neutral elements (pad) added for padding
-	if (A[id] != pad)
+		for (int r = 0; r < ranks; r++)
+		{
+			if ((key & mask) == prefix[r])
+				atomic_inc(&scratch[r * 256 + digit]);
+		}
+	}
+
+	// Wait for all local threads to finish counting
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	// Merge the local histograms into the global histograms
+	for (int b = lid; b < bins; b += N)
+	{
+		if (scratch[b])
+			atomic_add(&H[b], scratch[b]);
+	}
+}
+
+// Radix Select (narrowing step)
+// One work-item per rank: find the bucket of the histogram holding the rank, then narrow the prefix and the rank
+// within that bucket. Keeps every pass of the selection on the device, so nothing is read back between passes.
+__kernel void radix_select_narrow(__global const uint* H, __global uint* prefix, __global uint* remaining, int shift)
+{
+	int r = get_global_id(0);
+	uint rank = remaining[r];
+	int bin = 0;
+
+	while (bin < 255 && rank >= H[r * 256 + bin])
 	{
-		// Cache all N elements from global memory to local memory
-		scratch[lid] = A[id];
+		rank -= H[r * 256 + bin];
+		bin++;
 	}
 
+	remaining[r] = rank;
+	prefix[r] |= (uint)bin << shift;
+}
+
+// Quantile Sketch (block compaction)
+// Each workgroup of N work-items sorts a block of 2N elements in local memory (ascending, like bitonic_sort_local),
+// then keeps every step-th element from a pseudo-random offset, so each sample stands for step elements (step is a
+// power of two, at most 2N). The host merges the samples of every block into its sketch (see Sketch.h).
+// Only whole blocks are launched, the host adds the last few elements of a chunk itself.
+__kernel void sketch_compact(__global const float* A, __global float* S, __local float* scratch, int step, uint seed)
+{
+	int lid = get_local_id(0);
+	int N = get_local_size(0);
+	int group = get_group_id(0);
+	int block = group * 2 * N;
+
+	// Cache the 2N elements of this block from global memory to local memory
+	scratch[lid] = A[block + lid];
+	scratch[lid + N] = A[block + lid + N];
+
 	// Wait for all local threads to finish copying from global to local memory
 	barrier(CLK_LOCAL_MEM_FENCE);
 
-	// Step through the data and accumulate the max in each workgroup
-	for (int i = 1; i < N; i *= 2)
+	for (int k = 2; k <= 2 * N; k *= 2)
 	{
-		// Stride through the vector
-		if (!(lid % (i * 2)) && ((lid + i) < N))
+		for (int j = k / 2; j > 0; j /= 2)
 		{
-			// If this element is greater than the current max of this workgroup
-			if (scratch[lid] < scratch[lid + i])
+			int i = ((lid & ~(j - 1)) << 1) | (lid & (j - 1));
+
+			// The direction alternates within the block, and the last stage sorts the whole block ascending
+			bool ascending = (i & k) == 0;
+
+			float a = scratch[i];
+			float b = scratch[i + j];
+
+			if ((a > b) == ascending)
 			{
-				// Keep this element in this workgroup
-				scratch[lid] = scratch[lid + i];
+				scratch[i] = b;
+				scratch[i + j] = a;
 			}
+
+			// Wait for all local threads to finish this step
+			barrier(CLK_LOCAL_MEM_FENCE);
 		}
-		barrier(CLK_LOCAL_MEM_FENCE);
 	}
 
-	// Copy the cache to the output vector
-	if (!lid)
+	// Offset of the samples within this block, from an integer hash of the seed and the block
+	uint h = seed ^ ((uint)group * 0x9E3779B9u);
+	h ^= h >> 16;
+	h *= 0x85EBCA6Bu;
+	h ^= h >> 13;
+	h *= 0xC2B2AE35u;
+	h ^= h >> 16;
+	int offset = (int)(h & (uint)(step - 1));
+
+	int samples = 2 * N / step;
+	for (int s = lid; s < samples; s += N)
+		S[group * samples + s] = scratch[s * step + offset];
+}
+
+// Workgroup size of the histogram, when tuned for the device (same as STATS_LOCAL)
+#ifdef HISTOGRAM_LOCAL
+#define HISTOGRAM_N HISTOGRAM_LOCAL
+#define HISTOGRAM_ATTRIBUTES __attribute__((reqd_work_group_size(HISTOGRAM_LOCAL, 1, 1)))
+#else
+#define HISTOGRAM_N get_local_size(0)
+#define HISTOGRAM_ATTRIBUTES
+#endif
+
+// Histogram
+// Bins every element at a fixed resolution: bin b holds the values closest to lo + b * resolution, and values outside
+// the range go to the first or last bin. Each workgroup counts into private bins in local memory, then merges them
+// into the global histogram with one atomic per bin (instead of one atomic per element).
+__kernel HISTOGRAM_ATTRIBUTES void histogram(__global const float* A, __global uint* H, __local uint* scratch, int n, int bins, float lo, float resolution)
+{
+	int lid = get_local_id(0);
+	int N = HISTOGRAM_N;
+
+	// Clear the local bins
+	for (int b = lid; b < bins; b += N)
+		scratch[b] = 0;
+
+	// Wait for all local threads to finish clearing local memory
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (int i = get_global_id(0); i < n; i += get_global_size(0))
 	{
-		// Accumulate the max of the calculated partial max results to the first element of the output vector
-		// (serial operation)
-		atomic_max(&B[0], scratch[lid]);
+		int bin = clamp(convert_int_rte((A[i] - lo) / resolution), 0, bins - 1);
+		atomic_inc(&scratch[bin]);
+	}
+
+	// Wait for all local threads to finish counting
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	// Merge the local bins into the global histogram
+	for (int b = lid; b < bins; b += N)
+	{
+		if (scratch[b])
+			atomic_add(&H[b], scratch[b]);
 	}
 }
 
-// (Atomic) Min
-__kernel void reduce_min(__global const int* A, __global int* B, __local int* scratch, float pad)
+// Histogram of a column stored as 16-bit tenths of a degree
+// Same as histogram, but the bins are one tenth wide, so the bin of every element is a subtraction (lo in tenths)
+__kernel void histogram_fixed(__global const short* A, __global uint* H, __local uint* scratch, int n, int bins, int lo)
 {
-	int id = get_global_id(0);
 	int lid = get_local_id(0);
 	int N = get_local_size(0);
 
-	// Copies values to local memory
-	scratch[lid] = A[id];
+	for (int b = lid; b < bins; b += N)
+		scratch[b] = 0;
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (int i = get_global_id(0); i < n; i += get_global_size(0))
+		atomic_inc(&scratch[clamp(A[i] - lo, 0, bins - 1)]);
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (int b = lid; b < bins; b += N)
+	{
+		if (scratch[b])
+			atomic_add(&H[b], scratch[b]);
+	}
+}
+
+// Row filter shared by the filtered kernels (see RowFilter on the host): a station (-1 = any), a mask and value
+// on the packed date/time (equality on any of its year, month, day and time fields) and an inclusive date/time range
+bool row_matches(ushort station_id, uint date_time, int station, uint mask, uint value, uint from, uint to)
+{
+	return (station < 0 || station_id == station) && ((date_time & mask) == value) && date_time >= from && date_time <= to;
+}
+
+// Histogram of the rows matching a filter
+// Same as histogram, except that rows failing the filter are skipped, so filtered queries need no copy of the data
+__kernel void histogram_where(__global const ushort* stations, __global const uint* date_times, __global const float* A, __global uint* H, __local uint* scratch,
+	int n, int bins, float lo, float resolution, int station, uint mask, uint value, uint from, uint to)
+{
+	int lid = get_local_id(0);
+	int N = get_local_size(0);
+
+	for (int b = lid; b < bins; b += N)
+		scratch[b] = 0;
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (int i = get_global_id(0); i < n; i += get_global_size(0))
+	{
+		if (row_matches(stations[i], date_times[i], station, mask, value, from, to))
+		{
+			int bin = clamp(convert_int_rte((A[i] - lo) / resolution), 0, bins - 1);
+			atomic_inc(&scratch[bin]);
+		}
+	}
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (int b = lid; b < bins; b += N)
+	{
+		if (scratch[b])
+			atomic_add(&H[b], scratch[b]);
+	}
+}
+
+// Fused statistics of the rows matching a filter
+// Same as reduce_statistics (combined by combine_statistics), except that rows failing the filter are skipped. The
+// columns and the filter follow the arguments of reduce_statistics, so that both share one launch on the host.
+__kernel void reduce_statistics_where(__global const float* A, __global Stats* B, __local Stats* scratch, int n,
+	__global const ushort* stations, __global const uint* date_times, int station, uint mask, uint value, uint from, uint to)
+{
+	int lid = get_local_id(0);
+	int N = get_local_size(0);
+
+	Stats partial = stats_empty();
+	for (int i = get_global_id(0); i < n; i += get_global_size(0))
+	{
+		if (row_matches(stations[i], date_times[i], station, mask, value, from, to))
+			partial = stats_add(partial, A[i]);
+	}
+
+	scratch[lid] = partial;
 
-	// Wait for all local threads to finish copying from global to local memory
 	barrier(CLK_LOCAL_MEM_FENCE);
 
-	// Step through the data and accumulate the min in each workgroup
 	for (int i = 1; i < N; i *= 2)
 	{
-		// Stride through the vector
 		if (!(lid % (i * 2)) && ((lid + i) < N))
 		{
-			// If this element is less than the current max of this workgroup
-			if (scratch[lid] > scratch[lid + i])
-			{
-				// Keep this element in this workgroup
-				scratch[lid] = scratch[lid + i];
-			}
+			scratch[lid] = stats_merge(scratch[lid], scratch[lid + i]);
 		}
-		// Wait for all local threads to finish partial sum accumulation
 		barrier(CLK_LOCAL_MEM_FENCE);
 	}
 
-	// Copy the cache to the output vector
 	if (!lid)
 	{
-		// Accumulate the min of the calculated partial min results to the first element of the output vector
-		// (serial operation)
-		atomic_min(&B[0], scratch[lid]);
+		B[get_group_id(0)] = scratch[0];
 	}
 }
 
-// Custom Atomic Add (for handling floats)
-void atomicAdd(__global float *addr, float val)
+// Predicate pushdown (flag step)
+// One flag per row: 1 if the row matches the filter, else 0 (also 0 for the padding up to the size of the scan)
+__kernel void filter_flags(__global const ushort* stations, __global const uint* date_times, __global uint* F, int n,
+	int station, uint mask, uint value, uint from, uint to)
 {
-	union 
+	int id = get_global_id(0);
+	F[id] = (id < n && row_matches(stations[id], date_times[id], station, mask, value, from, to)) ? 1 : 0;
+}
+
+// Element type of the scan kernels (the rolling-window mode builds the program again with -D SCAN_T=long)
+#ifndef SCAN_T
+#define SCAN_T uint
+#endif
+
+// Exclusive scan (block step)
+// Work-efficient (Blelloch) scan of blocks of 2N elements in local memory, one block per workgroup: an up-sweep
+// builds a tree of partial sums, then a down-sweep turns it into the exclusive prefix sums. The total of every
+// block goes to sums, which is scanned in turn and added back by scan_add when there is more than one block.
+__kernel void scan_blocks(__global SCAN_T* A, __global SCAN_T* sums, __local SCAN_T* scratch)
+{
+	int lid = get_local_id(0);
+	int N = get_local_size(0);
+	int block = get_group_id(0);
+	int first = block * 2 * N;
+
+	scratch[lid] = A[first + lid];
+	scratch[lid + N] = A[first + lid + N];
+
+	// Up-sweep: each level adds the left child into the right child
+	int offset = 1;
+	for (int d = N; d > 0; d >>= 1)
+	{
+		barrier(CLK_LOCAL_MEM_FENCE);
+		if (lid < d)
+		{
+			int left = offset * (2 * lid + 1) - 1;
+			int right = offset * (2 * lid + 2) - 1;
+			scratch[right] += scratch[left];
+		}
+		offset *= 2;
+	}
+
+	// The root holds the total of the block, replaced by zero for the down-sweep
+	if (!lid)
 	{
-		unsigned int u32;
-		float        f32;
-	} next, expected, current;
-	current.f32 = *addr;
-	do 
+		sums[block] = scratch[2 * N - 1];
+		scratch[2 * N - 1] = 0;
+	}
+
+	// Down-sweep: each level passes its value to the left child and adds the left child's old value to the right one
+	for (int d = 1; d < 2 * N; d *= 2)
 	{
-		expected.f32 = current.f32;
-		next.f32 = expected.f32 + val;
-		current.u32 = atomic_cmpxchg((volatile __global unsigned int *)addr, expected.u32, next.u32);
-	} while (current.u32 != expected.u32);
+		offset >>= 1;
+		barrier(CLK_LOCAL_MEM_FENCE);
+		if (lid < d)
+		{
+			int left = offset * (2 * lid + 1) - 1;
+			int right = offset * (2 * lid + 2) - 1;
+			SCAN_T t = scratch[left];
+			scratch[left] = scratch[right];
+			scratch[right] += t;
+		}
+	}
+
+	// Wait for the last level of the down-sweep
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	A[first + lid] = scratch[lid];
+	A[first + lid + N] = scratch[lid + N];
+}
+
+// Exclusive scan (add step)
+// Adds the scanned total of all previous blocks to every element of a block (same launch shape as scan_blocks)
+__kernel void scan_add(__global SCAN_T* A, __global const SCAN_T* sums)
+{
+	int N = get_local_size(0);
+	int first = get_group_id(0) * 2 * N + get_local_id(0);
+	SCAN_T offset = sums[get_group_id(0)];
+
+	A[first] += offset;
+	A[first + N] += offset;
+}
+
+// Predicate pushdown (compaction step)
+// Every matching row writes its temperature to its slot in the dense output, given by the exclusive scan of the flags
+__kernel void compact_rows(__global const ushort* stations, __global const uint* date_times, __global const float* A, __global const uint* S, __global float* B, int n,
+	int station, uint mask, uint value, uint from, uint to)
+{
+	int id = get_global_id(0);
+	if (id < n && row_matches(stations[id], date_times[id], station, mask, value, from, to))
+		B[S[id]] = A[id];
+}
+
+// Days from 1970-01-01 to a date of the proleptic Gregorian calendar
+int days_from_civil(int year, int month, int day)
+{
+	year -= month <= 2;
+	int era = (year >= 0 ? year : year - 399) / 400;
+	int year_of_era = year - era * 400;
+	int day_of_year = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+	int day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+	return era * 146097 + day_of_era - 719468;
+}
+
+// Rolling windows (key step)
+// Builds one 64-bit sort key per row: station (16 bits), packed date/time (32 bits) and temperature in tenths of a
+// degree offset by 32768 (16 bits), so a single sort orders the readings by station then time and keeps the values
+__kernel void rolling_keys(__global const ushort* stations, __global const uint* date_times, __global const float* A, __global ulong* K, int n)
+{
+	int id = get_global_id(0);
+	if (id >= n)
+		return;
+
+	uint tenths = (uint)clamp(convert_int_rte(A[id] * 10.f) + 32768, 0, 65535);
+	K[id] = ((ulong)stations[id] << 48) | ((ulong)date_times[id] << 16) | tenths;
+}
+
+// Rolling windows (prepare step)
+// Minutes since 1970 of every sorted reading, and the values and squared values (in tenths) to be scanned,
+// as exact integers. The padding up to the size of the scans is zero.
+__kernel void rolling_prepare(__global const ulong* K, __global int* T, __global SCAN_T* V, __global SCAN_T* Q, int n)
+{
+	int id = get_global_id(0);
+	if (id >= n)
+	{
+		V[id] = 0;
+		Q[id] = 0;
+		return;
+	}
+
+	ulong key = K[id];
+	uint date_time = (uint)(key >> 16);
+	int time = date_time & 0xFFF;
+	T[id] = days_from_civil(date_time >> 21, (date_time >> 17) & 0xF, (date_time >> 12) & 0x1F) * 1440 + (time / 100) * 60 + time % 100;
+
+	SCAN_T tenths = (SCAN_T)((int)(key & 0xFFFF) - 32768);
+	V[id] = tenths;
+	Q[id] = tenths * tenths;
+}
+
+// Rolling windows (window step)
+// Mean and standard deviation of the readings of the same station within the window (t - window, t] of every reading:
+// a binary search finds the first reading of the window, then the sums come from two differences of the prefix sums
+__kernel void rolling_window(__global const ulong* K, __global const int* T, __global const SCAN_T* V, __global const SCAN_T* Q, __global float* M, __global float* S, int n, int window)
+{
+	int id = get_global_id(0);
+	if (id >= n)
+		return;
+
+	ulong station = K[id] >> 48;
+	int t = T[id];
+
+	// First reading of the same station later than t - window
+	int lo = 0, hi = id;
+	while (lo < hi)
+	{
+		int mid = (lo + hi) / 2;
+		ulong mid_station = K[mid] >> 48;
+		if (mid_station < station || (mid_station == station && T[mid] <= t - window))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	SCAN_T count = id + 1 - lo;
+	SCAN_T sum = V[id + 1] - V[lo];
+	SCAN_T squares = Q[id + 1] - Q[lo];
+
+	// The variance numerator is exact in integers (tenths squared)
+	M[id] = (float)sum / (float)count / 10.f;
+	S[id] = sqrt((float)(count * squares - sum * sum) / (float)(count * count)) / 10.f;
 }
 
+// Group-by (key step)
+// Builds one 64-bit sort key per row: the group of the row in the upper half and the order-preserving key of its
+// temperature in the lower half, so a single sort gives one contiguous segment per group, sorted by temperature.
+// Groups: 0 = station, 1 = year (counted from the first year, base), 2 = station x month (station * 16 + month)
+__kernel void group_keys(__global const ushort* stations, __global const uint* date_times, __global const float* A, __global ulong* K, int n, int mode, uint base)
+{
+	int id = get_global_id(0);
+	if (id >= n)
+		return;
+
+	uint date_time = date_times[id];
+	uint group;
+	if (mode == 0)
+		group = stations[id];
+	else if (mode == 1)
+		group = (date_time >> 21) - base;
+	else
+		group = ((uint)stations[id] << 4) | ((date_time >> 17) & 0xF);
+
+	K[id] = ((ulong)group << 32) | float_to_key(A[id]);
+}
+
+// Group-by (segment step)
+// Finds the first and one-past-last element of every group within the sorted keys
+__kernel void segment_bounds(__global const ulong* K, __global uint* start, __global uint* end, int n)
+{
+	int id = get_global_id(0);
+	if (id >= n)
+		return;
+
+	uint group = (uint)(K[id] >> 32);
+
+	if (id == 0 || (uint)(K[id - 1] >> 32) != group)
+		start[group] = id;
+	if (id == n - 1 || (uint)(K[id + 1] >> 32) != group)
+		end[group] = id + 1;
+}
+
+// Group-by (statistics step)
+// One workgroup per group: reduces the segment of the group like reduce_statistics, then reads the quartiles
+// straight from the sorted segment (same ranks as the whole data set)
+__kernel void group_statistics(__global const ulong* K, __global const uint* start, __global const uint* end, __global Stats* S, __global float* Q, __local Stats* scratch)
+{
+	int lid = get_local_id(0);
+	int N = get_local_size(0);
+	int group = get_group_id(0);
+	uint first = start[group];
+	uint count = end[group] - first;
+
+	Stats partial = stats_empty();
+	for (uint i = lid; i < count; i += N)
+		partial = stats_add(partial, key_to_float((uint)K[first + i]));
+
+	scratch[lid] = partial;
+
+	// Wait for all local threads to finish accumulating
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (int i = 1; i < N; i *= 2)
+	{
+		if (!(lid % (i * 2)) && ((lid + i) < N))
+		{
+			scratch[lid] = stats_merge(scratch[lid], scratch[lid + i]);
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+
+	if (!lid)
+	{
+		S[group] = scratch[0];
+
+		// First quartile, median and third quartile (clamped, so that tiny groups stay within their segment)
+		int ranks[3] = { (int)count / 4 - 1, (int)count / 2 - 1, (int)count / 2 + (int)count / 4 };
+		for (int r = 0; r < 3; r++)
+		{
+			int rank = clamp(ranks[r], 0, max((int)count - 1, 0));
+			Q[group * 3 + r] = count ? key_to_float((uint)K[first + rank]) : 0.f;
+		}
+	}
+}
 
 //Median
 